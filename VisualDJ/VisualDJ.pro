@@ -9,79 +9,15 @@ QT += core gui opengl multimedia widgets
 TEMPLATE = app
 
 
-unix:DIR_OPENCV_LIBS = /usr/local/lib
-
 unix:INCLUDEPATH += "/usr/include/GL/"                             # OpenGL
 unix:LIBS += "/usr/lib/x86_64-linux-gnu/libglut.so"                # OpenGL
 
-unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_core.so         # OpenCV
-unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_highgui.so      # OpenCV
-unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_imgproc.so      # OpenCV
-unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_objdetect.so    # OpenCV
-unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_calib3d.so      # OpenCV
-unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_ml.so           # OpenCV
-#unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_contrib.so     # OpenCV
-
-unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_video.so
-unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_features2d.so
-
-unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_flann.so
-#unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_gpu.so
-#unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_legacy.so
-unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_ml.so
-#unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_ocl.so
-unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_photo.so
-unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_stitching.so
-unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_superres.so
-#unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_ts.so
-unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_video.so
-unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_videostab.so
-unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_imgcodecs.so
-unix:LIBS += $$DIR_OPENCV_LIBS/libopencv_videoio.so
+include( opencv.pri )
 
 unix:LIBS += "/usr/lib/x86_64-linux-gnu/lib3ds.so"                 # Modelos 3D
 
 
 
-win32:DIR_OPENCV_LIBS = C:/Qt/OpenCV-3.1.0
-
-win32:INCLUDEPATH += "$$DIR_OPENCV_LIBS/opencv/sources/include"
-win32:INCLUDEPATH += "$$DIR_OPENCV_LIBS/opencv/sources/modules/core/include"
-win32:INCLUDEPATH += "$$DIR_OPENCV_LIBS/opencv/sources/modules/imgproc/include"
-win32:INCLUDEPATH += "$$DIR_OPENCV_LIBS/opencv/sources/modules/video/include"
-win32:INCLUDEPATH += "$$DIR_OPENCV_LIBS/opencv/sources/modules/flann/include"
-win32:INCLUDEPATH += "$$DIR_OPENCV_LIBS/opencv/sources/modules/features2d/include"
-win32:INCLUDEPATH += "$$DIR_OPENCV_LIBS/opencv/sources/modules/calib3d/include"
-win32:INCLUDEPATH += "$$DIR_OPENCV_LIBS/opencv/sources/modules/legacy/include"
-win32:INCLUDEPATH += "$$DIR_OPENCV_LIBS/opencv/sources/modules/objdetect/include"
-win32:INCLUDEPATH += "$$DIR_OPENCV_LIBS/opencv/sources/modules/highgui/include"
-win32:INCLUDEPATH += "$$DIR_OPENCV_LIBS/opencv/sources/modules/photo/include"
-win32:INCLUDEPATH += "$$DIR_OPENCV_LIBS/opencv/sources/modules/ml/include"
-win32:INCLUDEPATH += "$$DIR_OPENCV_LIBS/opencv/sources/modules/contrib/include"
-win32:INCLUDEPATH += "$$DIR_OPENCV_LIBS/opencv/sources/modules/hal/include"
-win32:INCLUDEPATH += "$$DIR_OPENCV_LIBS/opencv/sources/modules/imgcodecs/include"
-win32:INCLUDEPATH += "$$DIR_OPENCV_LIBS/opencv/sources/modules/videoio/include"
-
-win32:LIBS += -L"$$DIR_OPENCV_LIBS/opencv/compilado/lib"
-
-win32:LIBS += -lopencv_core310.dll
-win32:LIBS += -lopencv_highgui310.dll
-win32:LIBS += -lopencv_imgproc310.dll
-win32:LIBS += -lopencv_objdetect310.dll
-win32:LIBS += -lopencv_calib3d310.dll
-
-win32:LIBS += -lopencv_ml310.dll
-win32:LIBS += -lopencv_video310.dll
-win32:LIBS += -lopencv_features2d310.dll
-win32:LIBS += -lopencv_flann310.dll
-win32:LIBS += -lopencv_photo310.dll
-win32:LIBS += -lopencv_stitching310.dll
-win32:LIBS += -lopencv_superres310.dll
-win32:LIBS += -lopencv_video310.dll
-win32:LIBS += -lopencv_videostab310.dll
-win32:LIBS += -lopencv_imgcodecs310.dll
-win32:LIBS += -lopencv_videoio310.dll
-
 win32:LIBS += -lopengl32
 win32:LIBS += -lglu32
 
@@ -104,19 +40,13 @@ win32:LIBS += -l3ds
 
 
 
+include( aruco/aruco.pri )
+include( pipeline.pri )
+
 SOURCES += main.cpp\
            scene.cpp \
             texture.cpp \
 sound.cpp \
-           aruco/ar_omp.cpp \
-           aruco/arucofidmarkers.cpp \
-           aruco/board.cpp \
-           aruco/boarddetector.cpp \
-           aruco/cameraparameters.cpp \
-           aruco/highlyreliablemarkers.cpp \
-           aruco/marker.cpp \
-           aruco/markerdetector.cpp \
-           aruco/subpixelcorner.cpp \
     mixer.cpp
 
 HEADERS += \
@@ -124,17 +54,6 @@ HEADERS += \
            texture.hpp \
            sound.hpp \
            video.hpp \
-           aruco/ar_omp.h \
-           aruco/aruco.h \
-           aruco/arucofidmarkers.h \
-           aruco/board.h \
-           aruco/boarddetector.h \
-           aruco/cameraparameters.h \
-           aruco/exports.h \
-           aruco/highlyreliablemarkers.h \
-           aruco/marker.h \
-           aruco/markerdetector.h \
-           aruco/subpixelcorner.h \
     mixer.hpp
 
 FORMS   +=
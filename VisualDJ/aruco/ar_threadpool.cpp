@@ -0,0 +1,451 @@
+#include "ar_threadpool.h"
+#include "ar_timers.h"
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace aruco
+{
+
+namespace
+{
+
+//global() only locks the first time, the settings are read under globalMutex
+std::once_flag globalOnce;
+std::mutex globalMutex;
+std::unique_ptr<ThreadPool> globalPool;
+bool globalCreated=false;
+int globalThreads=0;
+std::vector<int> globalCores;
+
+//a waiting thread runs queued tasks or yields this many times before it blocks
+const int WAIT_SPINS=64;
+
+//pool and queue of the worker running on this thread, if any
+thread_local ThreadPool *currentPool=0;
+thread_local int currentWorker=-1;
+
+#ifdef __linux__
+bool setAffinity ( pthread_t thread,const std::vector<int> &cores )
+{
+    cpu_set_t set;
+    CPU_ZERO ( &set );
+    for ( size_t i=0;i<cores.size();i++ )
+        if ( cores[i]>=0 && cores[i]<CPU_SETSIZE ) CPU_SET ( cores[i],&set );
+    if ( CPU_COUNT ( &set ) ==0 ) return false;
+    return pthread_setaffinity_np ( thread,sizeof ( set ),&set ) ==0;
+}
+#endif
+
+}
+
+//A parallel loop. Shared with the tasks that help, which may start after the loop ended, so it
+//is only reused once all of them released it
+struct ThreadPool::Loop {
+    Loop() :next ( 0 ),done ( 0 ),slots ( 0 ),users ( 0 ),end ( 0 ),grain ( 1 ),total ( 0 ),call ( 0 ),body ( 0 ) {}
+    void reset ( int begin,int end_,int grain_,LoopBody call_,const void *body_,int users_ )
+    {
+        next=begin;
+        done=0;
+        slots=0;
+        users=users_;
+        end=end_;
+        grain=grain_;
+        total=end_-begin;
+        call=call_;
+        body=body_;
+    }
+    std::atomic<int> next,done,slots,users;
+    int end,grain,total;
+    //only used while done<total, the caller is still waiting then
+    LoopBody call;
+    const void *body;
+    std::mutex errorMutex;
+    std::exception_ptr error;
+};
+
+void ThreadPool::runChunks ( Loop &loop )
+{
+    int slot=-1;
+    while ( loop.next.load ( std::memory_order_relaxed ) <loop.end )
+    {
+        int first=loop.next.fetch_add ( loop.grain );
+        if ( first>=loop.end ) break;
+        //a slot is taken with the first chunk, so there are never more slots than threads
+        if ( slot<0 ) slot=loop.slots.fetch_add ( 1 );
+        int last=std::min ( first+loop.grain,loop.end );
+        try {
+            for ( int i=first;i<last;i++ ) loop.call ( loop.body,i,slot );
+        } catch ( ... ) {
+            std::lock_guard<std::mutex> lock ( loop.errorMutex );
+            if ( !loop.error ) loop.error=std::current_exception();
+        }
+        //the last chunk wakes the caller if it blocked
+        if ( loop.done.fetch_add ( last-first ) +last-first==loop.total ) notifyDone();
+    }
+}
+
+template<typename Done>
+void ThreadPool::waitUntil ( const Done &done )
+{
+    //the end of a loop is usually a matter of microseconds, a short spin saves the sleep
+    for ( int spin=0;spin<WAIT_SPINS && !done();spin++ )
+        if ( !runPending() ) std::this_thread::yield();
+    while ( !done() )
+    {
+        if ( runPending() ) continue;
+        //nothing queued, what is left is running in other threads. Counted before the check,
+        //so the one that finishes it either sees this thread blocked or this thread sees it done
+        _blocked.fetch_add ( 1 );
+        {
+            std::unique_lock<std::mutex> lock ( _doneMutex );
+            _done.wait ( lock,done );
+        }
+        _blocked.fetch_sub ( 1 );
+    }
+}
+
+void ThreadPool::notifyDone()
+{
+    if ( _blocked.load() ==0 ) return;
+    std::lock_guard<std::mutex> lock ( _doneMutex );
+    _done.notify_all();
+}
+
+ThreadPool::Loop *ThreadPool::acquireLoop()
+{
+    std::lock_guard<std::mutex> lock ( _loopMutex );
+    if ( _freeLoops.empty() )
+    {
+        _loops.push_back ( std::unique_ptr<Loop> ( new Loop ) );
+        //room for all of them, so releasing one never allocates
+        _freeLoops.reserve ( _loops.size() );
+        return _loops.back().get();
+    }
+    Loop *loop=_freeLoops.back();
+    _freeLoops.pop_back();
+    return loop;
+}
+
+void ThreadPool::releaseLoop ( Loop *loop )
+{
+    if ( loop->users.fetch_sub ( 1,std::memory_order_acq_rel ) !=1 ) return;
+    std::lock_guard<std::mutex> lock ( _loopMutex );
+    _freeLoops.push_back ( loop );
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+ThreadPool &ThreadPool::global()
+{
+    std::call_once ( globalOnce,[] {
+        std::lock_guard<std::mutex> lock ( globalMutex );
+        globalPool.reset ( new ThreadPool ( globalThreads,globalCores ) );
+        globalCreated=true;
+    } );
+    return *globalPool;
+}
+
+bool ThreadPool::configureGlobal ( int threads,const std::vector<int> &cores )
+{
+    std::lock_guard<std::mutex> lock ( globalMutex );
+    if ( globalCreated ) return false;
+    globalThreads=threads;
+    globalCores=cores;
+    return true;
+}
+
+bool ThreadPool::pinCurrentThread ( const std::vector<int> &cores )
+{
+#ifdef __linux__
+    return setAffinity ( pthread_self(),cores );
+#else
+    ( void ) cores;
+    return false;
+#endif
+}
+
+ThreadPool::ThreadPool ( int threads,const std::vector<int> &cores ) :_cores ( cores ),_pending ( 0 ),_stopping ( false ),_sleeping ( 0 ),_blocked ( 0 )
+{
+    if ( threads<=0 ) threads=cores.empty() ?int ( std::thread::hardware_concurrency() ) :int ( cores.size() );
+    //the thread that waits for a loop runs it too, so one less is created
+    int nWorkers=std::max ( threads,1 )-1;
+    for ( int i=0;i<=nWorkers;i++ ) _queues.emplace_back();
+    for ( int i=0;i<nWorkers;i++ )
+    {
+        _workers.push_back ( std::thread ( &ThreadPool::workerLoop,this,i ) );
+        if ( !_cores.empty() ) pin ( _workers.back() );
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock ( _sleepMutex );
+        _stopping=true;
+    }
+    _wakeUp.notify_all();
+    for ( size_t i=0;i<_workers.size();i++ ) _workers[i].join();
+}
+
+bool ThreadPool::pin ( std::thread &thread )
+{
+#ifdef __linux__
+    return setAffinity ( thread.native_handle(),_cores );
+#else
+    ( void ) thread;
+    return false;
+#endif
+}
+
+/************************************
+ *
+ * A worker pushes to and takes from the back of its own queue, the newest task, which is the one
+ * with its data still in cache. Any other thread pushes to the shared queue, and steals from the front
+ *
+ ************************************/
+void ThreadPool::WorkQueue::pushBack ( const Task &task )
+{
+    if ( count==tasks.size() )
+    {
+        //in order from the start, in a ring twice as large
+        std::vector<Task> grown ( std::max<size_t> ( 16,2*tasks.size() ) );
+        for ( size_t i=0;i<count;i++ ) grown[i].swap ( tasks[ ( first+i ) %tasks.size()] );
+        tasks.swap ( grown );
+        first=0;
+    }
+    tasks[ ( first+count ) %tasks.size()]=task;
+    count++;
+}
+
+void ThreadPool::WorkQueue::popBack ( Task &task )
+{
+    task.swap ( tasks[ ( first+count-1 ) %tasks.size()] );
+    count--;
+}
+
+void ThreadPool::WorkQueue::popFront ( Task &task )
+{
+    task.swap ( tasks[first] );
+    first= ( first+1 ) %tasks.size();
+    count--;
+}
+
+void ThreadPool::submit ( const Task &task )
+{
+    WorkQueue &queue=_queues[currentPool==this?currentWorker:_queues.size()-1];
+    {
+        std::lock_guard<std::mutex> lock ( queue.mutex );
+        queue.pushBack ( task );
+    }
+    _pending.fetch_add ( 1 );
+    std::lock_guard<std::mutex> lock ( _sleepMutex );
+    if ( _sleeping>0 ) _wakeUp.notify_one();
+}
+
+bool ThreadPool::popTask ( Task &task )
+{
+    int own=currentPool==this?currentWorker:-1;
+    if ( own>=0 )
+    {
+        WorkQueue &queue=_queues[own];
+        std::lock_guard<std::mutex> lock ( queue.mutex );
+        if ( queue.count>0 )
+        {
+            queue.popBack ( task );
+            _pending.fetch_sub ( 1 );
+            return true;
+        }
+    }
+    //the others from the next one, so the workers do not all steal from the same queue
+    int n=int ( _queues.size() );
+    for ( int k=1;k<=n;k++ )
+    {
+        int q= ( own+k+n ) %n;
+        if ( q==own ) continue;
+        WorkQueue &queue=_queues[q];
+        std::lock_guard<std::mutex> lock ( queue.mutex );
+        if ( queue.count>0 )
+        {
+            queue.popFront ( task );
+            _pending.fetch_sub ( 1 );
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::runPending()
+{
+    Task task;
+    if ( !popTask ( task ) ) return false;
+    task();
+    return true;
+}
+
+void ThreadPool::workerLoop ( int index )
+{
+    currentPool=this;
+    currentWorker=index;
+    std::ostringstream name;
+    name<<"worker "<<index;
+    Tracer::setThreadName ( name.str() );
+
+    while ( true )
+    {
+        if ( runPending() ) continue;
+        std::unique_lock<std::mutex> lock ( _sleepMutex );
+        if ( _stopping ) return;
+        if ( _pending.load() >0 ) continue;
+        _sleeping++;
+        _wakeUp.wait ( lock,[this] {return _stopping || _pending.load() >0;} );
+        _sleeping--;
+    }
+}
+
+/************************************
+ *
+ * The caller and up to size()-1 tasks take chunks until there are none. Then the caller waits for
+ * the chunks taken by others, running queued tasks meanwhile
+ *
+ ************************************/
+void ThreadPool::runLoop ( int begin,int end,LoopBody call,const void *body,int grain )
+{
+    if ( end<=begin ) return;
+    grain=std::max ( grain,1 );
+    int nChunks= ( end-begin+grain-1 ) /grain;
+    if ( nChunks==1 || _workers.empty() )
+    {
+        for ( int i=begin;i<end;i++ ) call ( body,i,0 );
+        return;
+    }
+
+    //a pointer and the pool, small enough for std::function to keep the task in place
+    Loop *loop=acquireLoop();
+    int helpers=std::min ( nChunks,size() )-1;
+    loop->reset ( begin,end,grain,call,body,helpers+1 );
+    for ( int h=0;h<helpers;h++ )
+        submit ( [this,loop] {runChunks ( *loop );releaseLoop ( loop );} );
+    runChunks ( *loop );
+    waitUntil ( [loop] {return loop->done.load() >=loop->total;} );
+    //all the chunks ran, the helpers still running do not touch the error
+    std::exception_ptr error;
+    error.swap ( loop->error );
+    releaseLoop ( loop );
+    if ( error ) std::rethrow_exception ( error );
+}
+
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void TaskGroup::run ( const ThreadPool::Task &task )
+{
+    _running.fetch_add ( 1 );
+    _pool.submit ( [this,task] {
+        try {
+            task();
+        } catch ( ... ) {
+            std::lock_guard<std::mutex> lock ( _errorMutex );
+            if ( !_error ) _error=std::current_exception();
+        }
+        //the group may be gone after this, only the pool is used
+        ThreadPool &pool=_pool;
+        if ( _running.fetch_sub ( 1 ) ==1 ) pool.notifyDone();
+    } );
+}
+
+void TaskGroup::finish()
+{
+    _pool.waitUntil ( [this] {return _running.load() ==0;} );
+}
+
+void TaskGroup::wait()
+{
+    finish();
+    if ( _error )
+    {
+        std::exception_ptr error=_error;
+        _error=std::exception_ptr();
+        std::rethrow_exception ( error );
+    }
+}
+
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+int TaskGraph::add ( const ThreadPool::Task &task )
+{
+    if ( _nNodes==_nodes.size() ) _nodes.emplace_back();
+    Node &node=_nodes[_nNodes];
+    node.task=task;
+    node.next.clear();
+    node.nDependencies=0;
+    return int ( _nNodes++ );
+}
+
+void TaskGraph::addDependency ( int before,int after )
+{
+    _nodes[before].next.push_back ( after );
+    _nodes[after].nDependencies++;
+}
+
+void TaskGraph::run ( ThreadPool &pool )
+{
+    _pool=&pool;
+    for ( size_t i=0;i<_nNodes;i++ ) _nodes[i].waitingFor.store ( _nodes[i].nDependencies );
+    for ( size_t i=0;i<_nNodes;i++ )
+        if ( _nodes[i].nDependencies==0 ) submitNode ( int ( i ) );
+    pool.waitUntil ( [this] {return _running.load() ==0;} );
+    if ( _error )
+    {
+        std::exception_ptr error;
+        error.swap ( _error );
+        std::rethrow_exception ( error );
+    }
+}
+
+void TaskGraph::submitNode ( int node )
+{
+    _running.fetch_add ( 1 );
+    _pool->submit ( [this,node] {runNode ( node );} );
+}
+
+void TaskGraph::runNode ( int node )
+{
+    //a task that throws does not start the ones that depend on it
+    bool failed=false;
+    try {
+        _nodes[node].task();
+    } catch ( ... ) {
+        failed=true;
+        std::lock_guard<std::mutex> lock ( _errorMutex );
+        if ( !_error ) _error=std::current_exception();
+    }
+    //the last dependency done starts the next task. It is counted before this one ends
+    const std::vector<int> &next=_nodes[node].next;
+    for ( size_t i=0;i<next.size() && !failed;i++ )
+    {
+        int n=next[i];
+        if ( _nodes[n].waitingFor.fetch_sub ( 1 ) ==1 ) submitNode ( n );
+    }
+    ThreadPool *pool=_pool;
+    if ( _running.fetch_sub ( 1 ) ==1 ) pool->notifyDone();
+}
+
+}
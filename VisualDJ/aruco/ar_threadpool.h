@@ -0,0 +1,205 @@
+#ifndef _Aruco_ThreadPool_H
+#define _Aruco_ThreadPool_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "exports.h"
+
+namespace aruco
+{
+
+/**\brief Persistent pool of worker threads with work stealing
+ *
+ * The workers are created once and sleep while there is nothing to do, so a parallel loop
+ * costs a few queue operations instead of starting and joining threads on every frame.
+ * Every worker has its own queue: it takes the newest of its tasks, and when it has none
+ * it steals the oldest of another worker. A thread that waits for its tasks runs tasks too,
+ * so loops and groups can be nested and called from several threads at the same time.
+ * When there is nothing left to run, it spins a little and then blocks until the last
+ * task it waits for signals, so it does not take the core from the threads doing the work.
+ *
+ * The workers can be pinned to some cores, to leave the others for threads that must not
+ * wait for vision, like audio. MarkerDetector, and BoardDetector through it, use global().
+ */
+class ARUCO_EXPORTS ThreadPool
+{
+public:
+    typedef std::function<void() > Task;
+
+    /**pool shared by the detectors of the process, created the first time it is used
+     * with the settings of configureGlobal()
+     */
+    static ThreadPool &global();
+    /**threads and cores of global(). Only has effect before its first use
+     * @param threads threads that run tasks, counting the one that waits. 0 for one per core, or per core in cores
+     * @param cores cores where the workers run. Empty for any
+     * @return false if the global pool already exists
+     */
+    static bool configureGlobal ( int threads,const std::vector<int> &cores=std::vector<int>() );
+    ///restricts the calling thread to cores. Returns false if not supported or not possible
+    static bool pinCurrentThread ( const std::vector<int> &cores );
+
+    ///See configureGlobal() for the parameters
+    explicit ThreadPool ( int threads=0,const std::vector<int> &cores=std::vector<int>() );
+    ~ThreadPool();
+
+    ///threads that can run the tasks of a loop at the same time: the workers and the one that waits
+    int size() const {return int ( _workers.size() ) +1;}
+    const std::vector<int> &getCores() const {return _cores;}
+
+    /**runs body(i,slot) for every i in [begin,end) and returns when all have run. The indices are
+     * taken in chunks of grain by the threads as they get free. slot is in [0,size()) and no two
+     * threads run the same loop with the same slot at the same time, so it can index scratch data
+     * of the caller. The first exception thrown by body is thrown here, once all the indices ran.
+     * body is called through a pointer, it is not copied, so a lambda of any size does not allocate
+     */
+    template<typename Body>
+    void parallelFor ( int begin,int end,const Body &body,int grain=1 )
+    {
+        runLoop ( begin,end,&callBody<Body>,&body,grain );
+    }
+
+    ///queues a task. Use TaskGroup or TaskGraph to wait for it
+    void submit ( const Task &task );
+
+private:
+    //a ring of tasks that only grows, so queueing does not allocate once it is large enough
+    struct WorkQueue {
+        WorkQueue() :first ( 0 ),count ( 0 ) {}
+        std::mutex mutex;
+        std::vector<Task> tasks;
+        size_t first,count;
+        void pushBack ( const Task &task );
+        void popBack ( Task &task );
+        void popFront ( Task &task );
+    };
+    struct Loop;
+    typedef void ( *LoopBody ) ( const void *body,int i,int slot );
+
+    template<typename Body>
+    static void callBody ( const void *body,int i,int slot ) {( *static_cast<const Body *> ( body ) ) ( i,slot );}
+    void runLoop ( int begin,int end,LoopBody call,const void *body,int grain );
+    ///runs queued tasks until done(), then blocks until notifyDone() is called with done() true
+    template<typename Done>
+    void waitUntil ( const Done &done );
+    ///wakes the threads blocked in waitUntil(), if any. Touches nothing but the pool
+    void notifyDone();
+
+    ///runs one queued task, if any. Returns false if there was none
+    bool runPending();
+    bool popTask ( Task &task );
+    void workerLoop ( int index );
+    bool pin ( std::thread &thread );
+    ///a loop of the free ones, or a new one. It goes back when its last user releases it
+    Loop *acquireLoop();
+    void releaseLoop ( Loop *loop );
+    void runChunks ( Loop &loop );
+
+    std::vector<std::thread> _workers;
+    std::vector<int> _cores;
+    //one queue per worker, and the last one for the tasks of the other threads
+    std::deque<WorkQueue> _queues;
+    std::atomic<int> _pending;
+    std::atomic<bool> _stopping;
+    std::mutex _sleepMutex;
+    std::condition_variable _wakeUp;
+    int _sleeping;
+    //the threads blocked until the loop, group or graph they wait for is done
+    std::mutex _doneMutex;
+    std::condition_variable _done;
+    std::atomic<int> _blocked;
+    //the loops are reused, the tasks that help in one keep a pointer to it
+    std::mutex _loopMutex;
+    std::vector<std::unique_ptr<Loop> > _loops;
+    std::vector<Loop *> _freeLoops;
+
+    friend class TaskGroup;
+    friend class TaskGraph;
+
+    ThreadPool ( const ThreadPool & );
+    ThreadPool &operator= ( const ThreadPool & );
+};
+
+/**\brief Tasks run in a pool that are waited together
+ *
+ * wait() runs queued tasks while the group is not done, and throws the first exception
+ * of its tasks. The destructor waits too, but only wait() throws.
+ */
+class ARUCO_EXPORTS TaskGroup
+{
+public:
+    explicit TaskGroup ( ThreadPool &pool=ThreadPool::global() ) :_pool ( pool ),_running ( 0 ) {}
+    ~TaskGroup() {finish();}
+
+    void run ( const ThreadPool::Task &task );
+    void wait();
+
+private:
+    void finish();
+
+    ThreadPool &_pool;
+    std::atomic<int> _running;
+    std::mutex _errorMutex;
+    std::exception_ptr _error;
+
+    TaskGroup ( const TaskGroup & );
+    TaskGroup &operator= ( const TaskGroup & );
+};
+
+/**\brief Tasks with dependencies, built and run once per frame
+ *
+ * A task starts as soon as the ones it depends on are done, so independent chains of work
+ * overlap instead of waiting for each other at every step. clear() keeps the storage of the
+ * nodes, so a graph like the one of the previous frame does not allocate them again. The
+ * tasks are queued as a pointer to the graph and an index, so they do not allocate either,
+ * as long as the tasks added are small enough for std::function to keep them in place.
+ */
+class ARUCO_EXPORTS TaskGraph
+{
+public:
+    TaskGraph() :_nNodes ( 0 ),_pool ( 0 ),_running ( 0 ) {}
+
+    ///removes all the tasks
+    void clear() {_nNodes=0;}
+    ///adds a task and returns its index
+    int add ( const ThreadPool::Task &task );
+    ///task after can not start until before is done. before<after, so the graph has no cycles
+    void addDependency ( int before,int after );
+    int size() const {return int ( _nNodes );}
+
+    ///runs all the tasks in pool and returns when they are done. Throws the first exception of a task
+    void run ( ThreadPool &pool=ThreadPool::global() );
+
+private:
+    struct Node {
+        ThreadPool::Task task;
+        std::vector<int> next;
+        int nDependencies;
+        std::atomic<int> waitingFor;
+    };
+
+    void submitNode ( int node );
+    void runNode ( int node );
+
+    std::deque<Node> _nodes;
+    size_t _nNodes;
+    //while running
+    ThreadPool *_pool;
+    std::atomic<int> _running;
+    std::mutex _errorMutex;
+    std::exception_ptr _error;
+
+    TaskGraph ( const TaskGraph & );
+    TaskGraph &operator= ( const TaskGraph & );
+};
+
+}
+
+#endif
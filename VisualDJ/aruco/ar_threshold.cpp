@@ -0,0 +1,186 @@
+#include "ar_threshold.h"
+#include "ar_threadpool.h"
+#include <algorithm>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace aruco
+{
+
+namespace
+{
+
+//rows handled by one task at least, every stripe sums blockSize rows before its first output row
+const int MIN_STRIPE_ROWS=32;
+
+/************************************
+ *
+ * Stripe s of rows, with the column sums of the thread that runs it. They are kept with the border already replicated: entry i is the
+ * column i-radius, clamped, so the horizontal sum of a pixel is a plain window over them
+ *
+ ************************************/
+class AdaptiveThresholdStripes
+{
+public:
+    AdaptiveThresholdStripes ( const cv::Mat &in,cv::Mat &out,int blockSize,int nStripes,const uchar *meanTab,const uchar *thresTab ) :
+        _in ( in ),_out ( out ),_radius ( blockSize/2 ),_nStripes ( nStripes ),_meanTab ( meanTab ),_thresTab ( thresTab ) {}
+
+    void operator() ( int s,std::vector<int> &colSum ) const
+    {
+        int width=_in.cols,height=_in.rows;
+        colSum.resize ( width+2*_radius );
+
+        int y0=int ( ( long long ) height*s/_nStripes );
+        int y1=int ( ( long long ) height* ( s+1 ) /_nStripes );
+        if ( y0>=y1 ) return;
+
+        std::fill ( colSum.begin(),colSum.end(),0 );
+        for ( int dy=-_radius;dy<=_radius;dy++ )
+            updateColumns ( &colSum[0],_in.ptr<uchar> ( clampRow ( y0+dy ) ),0 );
+
+        for ( int y=y0;y<y1;y++ )
+        {
+            const uchar *src=_in.ptr<uchar> ( y );
+            uchar *dst=_out.ptr<uchar> ( y );
+            int sum=0;
+            for ( int i=0;i<=2*_radius;i++ ) sum+=colSum[i];
+            for ( int x=0;x<width;x++ )
+            {
+                dst[x]=_thresTab[int ( src[x] )-int ( _meanTab[sum] ) +255];
+                if ( x+1<width ) sum+=colSum[x+2*_radius+1]-colSum[x];
+            }
+            //slide the block down: the row that enters and the one that leaves
+            if ( y+1<y1 )
+                updateColumns ( &colSum[0],_in.ptr<uchar> ( clampRow ( y+_radius+1 ) ),_in.ptr<uchar> ( clampRow ( y-_radius ) ) );
+        }
+    }
+
+private:
+    int clampRow ( int y ) const {return std::min ( std::max ( y,0 ),_in.rows-1 );}
+
+    //adds the row add and, if not null, subtracts the row sub
+    void updateColumns ( int *colSum,const uchar *add,const uchar *sub ) const
+    {
+        int width=_in.cols;
+        int addLeft=add[0],addRight=add[width-1];
+        int subLeft=sub?sub[0]:0,subRight=sub?sub[width-1]:0;
+        for ( int i=0;i<_radius;i++ )
+        {
+            colSum[i]+=addLeft-subLeft;
+            colSum[_radius+width+i]+=addRight-subRight;
+        }
+
+        int *sums=colSum+_radius;
+        int x=0;
+#ifdef __SSE2__
+        const __m128i zero=_mm_setzero_si128();
+        for ( ;x+8<=width;x+=8 )
+        {
+            __m128i a=_mm_unpacklo_epi8 ( _mm_loadl_epi64 ( ( const __m128i * ) ( add+x ) ),zero );
+            __m128i d=sub?_mm_unpacklo_epi8 ( _mm_loadl_epi64 ( ( const __m128i * ) ( sub+x ) ),zero ) :zero;
+            //8 differences in 16 bits, then widened with their sign
+            __m128i diff=_mm_sub_epi16 ( a,d );
+            __m128i sign=_mm_srai_epi16 ( diff,15 );
+            __m128i s0=_mm_loadu_si128 ( ( const __m128i * ) ( sums+x ) );
+            __m128i s1=_mm_loadu_si128 ( ( const __m128i * ) ( sums+x+4 ) );
+            _mm_storeu_si128 ( ( __m128i * ) ( sums+x ),_mm_add_epi32 ( s0,_mm_unpacklo_epi16 ( diff,sign ) ) );
+            _mm_storeu_si128 ( ( __m128i * ) ( sums+x+4 ),_mm_add_epi32 ( s1,_mm_unpackhi_epi16 ( diff,sign ) ) );
+        }
+#endif
+        if ( sub ) for ( ;x<width;x++ ) sums[x]+=int ( add[x] )-int ( sub[x] );
+        else for ( ;x<width;x++ ) sums[x]+=add[x];
+    }
+
+    const cv::Mat &_in;
+    cv::Mat &_out;
+    int _radius,_nStripes;
+    const uchar *_meanTab,*_thresTab;
+};
+
+/************************************
+ *
+ * Tables and column sums of the calls of a thread, kept from one frame to the next. A call made while another one of
+ * the same thread waits for its stripes, running queued tasks, uses its own
+ *
+ ************************************/
+struct ThresholdWorkspace {
+    ThresholdWorkspace() :blockSize ( 0 ),idelta ( 0 ),imaxval ( 0 ),inUse ( false ) {}
+    int blockSize;
+    std::vector<uchar> meanTab;
+    int idelta;
+    uchar imaxval;
+    std::vector<uchar> thresTab;
+    std::vector<std::vector<int> > colSums;//one per slot of the pool
+    bool inUse;
+};
+
+thread_local ThresholdWorkspace threadWorkspace;
+
+struct WorkspaceUse {
+    explicit WorkspaceUse ( ThresholdWorkspace &ws ) :_ws ( ws ) {_ws.inUse=true;}
+    ~WorkspaceUse() {_ws.inUse=false;}
+    ThresholdWorkspace &_ws;
+};
+
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+void adaptiveThresholdMean ( const cv::Mat &in,cv::Mat &out,int blockSize,double delta,double maxValue ) throw ( cv::Exception )
+{
+    if ( in.type() !=CV_8UC1 ) throw cv::Exception ( 9001,"in.type()!=CV_8UC1","adaptiveThresholdMean",__FILE__,__LINE__ );
+    if ( blockSize<3 || blockSize%2!=1 ) throw cv::Exception ( 9001,"blockSize must be odd and >=3","adaptiveThresholdMean",__FILE__,__LINE__ );
+    //the rows are read after the ones above are written, so in place it goes through a copy
+    if ( !out.empty() && out.data==in.data )
+    {
+        cv::Mat aux;
+        adaptiveThresholdMean ( in,aux,blockSize,delta,maxValue );
+        aux.copyTo ( out );
+        return;
+    }
+
+    out.create ( in.size(),CV_8UC1 );
+    if ( in.empty() ) return;
+
+    ThresholdWorkspace local;
+    ThresholdWorkspace &ws=threadWorkspace.inUse?local:threadWorkspace;
+    WorkspaceUse use ( ws );
+
+    //mean of the block for every possible sum, rounded like the normalized box filter.
+    //The area is odd, so a sum is never half way between two means
+    if ( ws.blockSize!=blockSize )
+    {
+        int area=blockSize*blockSize;
+        ws.meanTab.resize ( 255*area+1 );
+        for ( int s=0;s<int ( ws.meanTab.size() );s++ ) ws.meanTab[s]=uchar ( ( 2*s+area ) / ( 2*area ) );
+        ws.blockSize=blockSize;
+    }
+
+    //same table as cv::adaptiveThreshold, indexed by pixel-mean+255
+    int idelta=cvFloor ( delta );
+    uchar imaxval=cv::saturate_cast<uchar> ( maxValue );
+    if ( ws.thresTab.empty() || ws.idelta!=idelta || ws.imaxval!=imaxval )
+    {
+        ws.thresTab.resize ( 768 );
+        for ( int i=0;i<768;i++ ) ws.thresTab[i]=uchar ( i-255<=-idelta?imaxval:0 );
+        ws.idelta=idelta;
+        ws.imaxval=imaxval;
+    }
+
+    ThreadPool &pool=ThreadPool::global();
+    int nStripes=std::max ( 1,std::min ( pool.size() *2,in.rows/MIN_STRIPE_ROWS ) );
+    AdaptiveThresholdStripes stripes ( in,out,blockSize,nStripes,&ws.meanTab[0],&ws.thresTab[0] );
+    //column sums of each thread, they keep their size between calls on images of the same width
+    if ( ws.colSums.size() <size_t ( pool.size() ) ) ws.colSums.resize ( pool.size() );
+    std::vector<std::vector<int> > &colSums=ws.colSums;
+    pool.parallelFor ( 0,nStripes,[&] ( int s,int slot ) {stripes ( s,colSums[slot] );} );
+}
+
+}
@@ -0,0 +1,27 @@
+#ifndef _Aruco_Threshold_H
+#define _Aruco_Threshold_H
+
+#include <opencv2/core/core.hpp>
+#include "exports.h"
+
+namespace aruco
+{
+
+/**Adaptive threshold with the mean of the block, the same as
+ * cv::adaptiveThreshold ( in,out,maxValue,ADAPTIVE_THRESH_MEAN_C,THRESH_BINARY_INV,blockSize,delta )
+ * and with the same output, bit by bit.
+ *
+ * The box sums are kept as running sums, a column sum per pixel updated row by row, so every
+ * pixel is read twice and the mean is not stored in a second image. The image is split in
+ * horizontal stripes that run in parallel in ThreadPool::global(). The tables and the column
+ * sums are kept per calling thread, so a call like the last one does not allocate.
+ *
+ * @param in CV_8UC1 image
+ * @param out output, CV_8UC1 of the same size. Can be in
+ * @param blockSize side of the block, odd and >=3
+ */
+ARUCO_EXPORTS void adaptiveThresholdMean ( const cv::Mat &in,cv::Mat &out,int blockSize,double delta,double maxValue=255 ) throw ( cv::Exception );
+
+}
+
+#endif
@@ -0,0 +1,311 @@
+#include "ar_timers.h"
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace aruco
+{
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+TimingHistogram::TimingHistogram()
+{
+    reset();
+}
+
+void TimingHistogram::reset()
+{
+    for ( int i=0;i<BUCKETS;i++ ) _buckets[i].store ( 0,std::memory_order_relaxed );
+    _count.store ( 0,std::memory_order_relaxed );
+    _total.store ( 0,std::memory_order_relaxed );
+    _max.store ( 0,std::memory_order_relaxed );
+}
+
+/************************************
+ *
+ * Bucket b>=4 covers [ (4+b%4)<<(o-2) , (5+b%4)<<(o-2) ) with o=b/4+1, the power of two of its first value
+ *
+ ************************************/
+int TimingHistogram::bucketOf ( uint64_t nsecs )
+{
+    if ( nsecs<4 ) return int ( nsecs );
+#ifdef __GNUC__
+    int o=63-__builtin_clzll ( nsecs );
+#else
+    int o=0;
+    for ( uint64_t v=nsecs;v>1;v>>=1 ) o++;
+#endif
+    int b= ( o-1 ) *4+int ( ( nsecs>> ( o-2 ) ) &3 );
+    return b<BUCKETS?b:BUCKETS-1;
+}
+
+uint64_t TimingHistogram::bucketUpperBound ( int bucket )
+{
+    if ( bucket<4 ) return uint64_t ( bucket );
+    int o=bucket/4+1;
+    return ( ( uint64_t ( 5+bucket%4 ) ) << ( o-2 ) )-1;
+}
+
+void TimingHistogram::add ( uint64_t nsecs )
+{
+    _buckets[bucketOf ( nsecs )].fetch_add ( 1,std::memory_order_relaxed );
+    _count.fetch_add ( 1,std::memory_order_relaxed );
+    _total.fetch_add ( nsecs,std::memory_order_relaxed );
+    uint64_t m=_max.load ( std::memory_order_relaxed );
+    while ( nsecs>m && !_max.compare_exchange_weak ( m,nsecs,std::memory_order_relaxed ) ) {}
+}
+
+uint64_t TimingHistogram::percentile ( double p ) const
+{
+    //the buckets are read one by one while other threads may be adding, so the count is
+    //taken from the buckets themselves and not from _count
+    uint64_t n=0;
+    for ( int i=0;i<BUCKETS;i++ ) n+=_buckets[i].load ( std::memory_order_relaxed );
+    if ( n==0 ) return 0;
+    uint64_t rank=uint64_t ( p/100.*double ( n ) +0.5 );
+    if ( rank<1 ) rank=1;
+    if ( rank>n ) rank=n;
+    uint64_t acc=0;
+    for ( int i=0;i<BUCKETS;i++ )
+    {
+        acc+=_buckets[i].load ( std::memory_order_relaxed );
+        if ( acc>=rank ) return std::min ( bucketUpperBound ( i ),max() );
+    }
+    return max();
+}
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+namespace
+{
+TimingHistogram _stages[Timers::MAX_STAGES];
+std::atomic<int> _nStages ( 0 );
+std::mutex _registerMutex;
+}
+
+TimingHistogram &Timers::get ( const char *name )
+{
+    //only once per call site, ARUCO_SCOPED_TIMER keeps the reference
+    std::lock_guard<std::mutex> lock ( _registerMutex );
+    int n=_nStages.load ( std::memory_order_relaxed );
+    for ( int i=0;i<n;i++ )
+        if ( _stages[i].getName() ==name ) return _stages[i];
+    //when full, the stages that do not fit share the last one
+    if ( n==MAX_STAGES )
+    {
+        _stages[MAX_STAGES-1].setName ( "(other stages)" );
+        return _stages[MAX_STAGES-1];
+    }
+    _stages[n].setName ( name );
+    _nStages.store ( n+1,std::memory_order_release );
+    return _stages[n];
+}
+
+int Timers::size()
+{
+    return _nStages.load ( std::memory_order_acquire );
+}
+
+const TimingHistogram &Timers::at ( int i )
+{
+    return _stages[i];
+}
+
+void Timers::reset()
+{
+    for ( int i=0;i<size();i++ ) _stages[i].reset();
+}
+
+void Timers::dump ( std::ostream &str )
+{
+    const double ms=1e-6;
+    std::ios::fmtflags flags=str.flags();
+    str<<std::left<<std::setw ( 32 ) <<"stage"<<std::right<<std::setw ( 10 ) <<"count"
+       <<std::setw ( 10 ) <<"mean"<<std::setw ( 10 ) <<"p50"<<std::setw ( 10 ) <<"p95"
+       <<std::setw ( 10 ) <<"p99"<<std::setw ( 10 ) <<"max"<<" (ms)"<<std::endl;
+    str<<std::fixed<<std::setprecision ( 3 );
+    for ( int i=0;i<size();i++ )
+    {
+        const TimingHistogram &h=_stages[i];
+        uint64_t n=h.count();
+        str<<std::left<<std::setw ( 32 ) <<h.getName() <<std::right<<std::setw ( 10 ) <<n
+           <<std::setw ( 10 ) << ( n>0?double ( h.total() ) *ms/double ( n ) :0. )
+           <<std::setw ( 10 ) <<double ( h.percentile ( 50 ) ) *ms
+           <<std::setw ( 10 ) <<double ( h.percentile ( 95 ) ) *ms
+           <<std::setw ( 10 ) <<double ( h.percentile ( 99 ) ) *ms
+           <<std::setw ( 10 ) <<double ( h.max() ) *ms<<std::endl;
+    }
+    str.flags ( flags );
+}
+
+std::string Timers::report()
+{
+    std::stringstream str;
+    dump ( str );
+    return str.str();
+}
+
+uint64_t Timers::now()
+{
+    return uint64_t ( std::chrono::duration_cast<std::chrono::nanoseconds> ( std::chrono::steady_clock::now().time_since_epoch() ).count() );
+}
+
+
+/************************************
+ *
+ *
+ *
+ *
+ ************************************/
+std::atomic<bool> Tracer::_enabled ( false );
+
+namespace
+{
+struct Span
+{
+    const TimingHistogram *stage;
+    uint64_t begin,end;
+    int64_t frame;
+};
+
+//spans of one thread. Only that thread adds to it, the mutex is taken by write() too
+struct ThreadTrace
+{
+    int tid;
+    std::string name;
+    int64_t frame;
+    uint64_t dropped;
+    std::vector<Span> spans;
+    std::mutex mutex;
+};
+
+//thread traces are never deleted, a thread may end before the trace is written
+std::vector<ThreadTrace *> _threadTraces;
+std::mutex _threadTracesMutex;
+std::atomic<uint64_t> _traceStart ( 0 );
+thread_local ThreadTrace *_threadTrace=0;
+
+ThreadTrace &threadTrace()
+{
+    if ( _threadTrace==0 )
+    {
+        std::lock_guard<std::mutex> lock ( _threadTracesMutex );
+        _threadTrace=new ThreadTrace;
+        _threadTrace->tid=int ( _threadTraces.size() ) +1;
+        _threadTrace->frame=-1;
+        _threadTrace->dropped=0;
+        _threadTraces.push_back ( _threadTrace );
+    }
+    return *_threadTrace;
+}
+
+void writeJsonString ( std::ostream &str,const std::string &s )
+{
+    str<<'"';
+    for ( size_t i=0;i<s.size();i++ )
+    {
+        if ( s[i]=='"' || s[i]=='\\' ) str<<'\\'<<s[i];
+        else if ( ( unsigned char ) s[i] <0x20 ) str<<' ';
+        else str<<s[i];
+    }
+    str<<'"';
+}
+}
+
+void Tracer::start()
+{
+    _traceStart.store ( Timers::now(),std::memory_order_relaxed );
+    _enabled.store ( true,std::memory_order_relaxed );
+}
+
+void Tracer::stop()
+{
+    _enabled.store ( false,std::memory_order_relaxed );
+}
+
+void Tracer::setThreadName ( const std::string &name )
+{
+    ThreadTrace &trace=threadTrace();
+    std::lock_guard<std::mutex> lock ( trace.mutex );
+    trace.name=name;
+}
+
+void Tracer::setFrame ( int64_t id )
+{
+    threadTrace().frame=id;
+}
+
+void Tracer::record ( const TimingHistogram &stage,uint64_t begin,uint64_t end )
+{
+    ThreadTrace &trace=threadTrace();
+    std::lock_guard<std::mutex> lock ( trace.mutex );
+    if ( trace.spans.size() >=MAX_SPANS_PER_THREAD )
+    {
+        trace.dropped++;
+        return;
+    }
+    Span span;
+    span.stage=&stage;
+    span.begin=begin;
+    span.end=end;
+    span.frame=trace.frame;
+    trace.spans.push_back ( span );
+}
+
+bool Tracer::write ( const std::string &filePath )
+{
+    std::ofstream file ( filePath.c_str() );
+    if ( !file ) return false;
+
+    uint64_t start=_traceStart.load ( std::memory_order_relaxed );
+    file<<"{\"displayTimeUnit\":\"ms\",\"traceEvents\":["<<std::endl;
+    file<<std::fixed<<std::setprecision ( 3 );
+    bool first=true;
+
+    std::lock_guard<std::mutex> lock ( _threadTracesMutex );
+    for ( size_t t=0;t<_threadTraces.size();t++ )
+    {
+        ThreadTrace &trace=*_threadTraces[t];
+        std::lock_guard<std::mutex> traceLock ( trace.mutex );
+
+        std::stringstream name;
+        if ( trace.name.empty() ) name<<"thread "<<trace.tid;
+        else name<<trace.name;
+        if ( trace.dropped>0 ) name<<" ("<<trace.dropped<<" spans dropped)";
+        file<< ( first?"":",\n" ) <<"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"<<trace.tid<<",\"args\":{\"name\":";
+        writeJsonString ( file,name.str() );
+        file<<"}}";
+        first=false;
+
+        //times in microseconds since the trace started
+        for ( size_t i=0;i<trace.spans.size();i++ )
+        {
+            const Span &span=trace.spans[i];
+            uint64_t begin=span.begin>start?span.begin-start:0;
+            uint64_t end=span.end>start?span.end-start:0;
+            file<<",\n{\"name\":";
+            writeJsonString ( file,span.stage->getName() );
+            file<<",\"ph\":\"X\",\"pid\":1,\"tid\":"<<trace.tid
+                <<",\"ts\":"<<double ( begin ) *1e-3<<",\"dur\":"<<double ( end-begin ) *1e-3;
+            if ( span.frame>=0 ) file<<",\"args\":{\"frame\":"<<span.frame<<"}";
+            file<<"}";
+        }
+    }
+    file<<"\n]}"<<std::endl;
+    return bool ( file );
+}
+
+}
@@ -0,0 +1,142 @@
+#ifndef _Aruco_Timers_H
+#define _Aruco_Timers_H
+
+#include <atomic>
+#include <ostream>
+#include <string>
+#include <stdint.h>
+#include "exports.h"
+
+namespace aruco
+{
+
+/**\brief Latency histogram of one processing stage
+ *
+ * Lock free: any thread can add samples while another one reads them. The buckets are
+ * powers of two of the nanoseconds split in four linear steps, so a percentile is known
+ * with about 20% of error and the histogram never grows.
+ */
+class ARUCO_EXPORTS TimingHistogram
+{
+public:
+    static const int BUCKETS=4*40;
+
+    TimingHistogram();
+
+    const std::string &getName() const {return _name;}
+    void setName ( const std::string &name ) {_name=name;}
+
+    ///adds a sample, in nanoseconds
+    void add ( uint64_t nsecs );
+    ///removes all the samples
+    void reset();
+
+    uint64_t count() const {return _count.load ( std::memory_order_relaxed );}
+    uint64_t total() const {return _total.load ( std::memory_order_relaxed );}
+    uint64_t max() const {return _max.load ( std::memory_order_relaxed );}
+    ///nanoseconds under which the p percent of the samples are. 0 if there are none
+    uint64_t percentile ( double p ) const;
+
+private:
+    static int bucketOf ( uint64_t nsecs );
+    static uint64_t bucketUpperBound ( int bucket );
+
+    std::string _name;
+    std::atomic<uint64_t> _buckets[BUCKETS];
+    std::atomic<uint64_t> _count,_total,_max;
+
+    TimingHistogram ( const TimingHistogram & );
+    TimingHistogram &operator= ( const TimingHistogram & );
+};
+
+/**\brief Registry of the stage histograms of the process
+ *
+ * A stage is registered the first time its name is used and lives until the process
+ * ends, so the histograms can be kept by reference. Use ARUCO_SCOPED_TIMER to time a block.
+ */
+class ARUCO_EXPORTS Timers
+{
+public:
+    static const int MAX_STAGES=64;
+
+    ///histogram of the stage. The same name gives always the same histogram
+    static TimingHistogram &get ( const char *name );
+    ///number of stages registered so far
+    static int size();
+    static const TimingHistogram &at ( int i );
+    ///removes the samples of every stage
+    static void reset();
+
+    ///one line per stage with count, mean, p50, p95, p99 and max in milliseconds
+    static void dump ( std::ostream &str );
+    static std::string report();
+
+    ///monotonic clock, in nanoseconds
+    static uint64_t now();
+};
+
+/**\brief Timeline of the scoped timers in the trace event format, for chrome://tracing or Perfetto
+ *
+ * Off by default. Once started, every ARUCO_SCOPED_TIMER also leaves a span with the thread
+ * that ran it and the frame that thread was working on. Every thread writes to its own
+ * buffer, so threads do not wait for each other while tracing.
+ */
+class ARUCO_EXPORTS Tracer
+{
+public:
+    ///spans kept per thread, the rest are counted and dropped
+    static const size_t MAX_SPANS_PER_THREAD=1<<20;
+
+    static void start();
+    static void stop();
+    static bool isEnabled() {return _enabled.load ( std::memory_order_relaxed );}
+
+    ///name shown for the calling thread
+    static void setThreadName ( const std::string &name );
+    ///frame the calling thread is working on, added to its spans. -1 for none
+    static void setFrame ( int64_t id );
+
+    static void record ( const TimingHistogram &stage,uint64_t begin,uint64_t end );
+
+    ///writes the spans recorded so far as trace event JSON
+    static bool write ( const std::string &filePath );
+
+private:
+    static std::atomic<bool> _enabled;
+};
+
+///Adds the time between its construction and its destruction to a histogram
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer ( TimingHistogram &histogram ) :_histogram ( histogram ),_start ( Timers::now() ) {}
+    ~ScopedTimer()
+    {
+        uint64_t end=Timers::now();
+        _histogram.add ( end-_start );
+        if ( Tracer::isEnabled() ) Tracer::record ( _histogram,_start,end );
+    }
+
+private:
+    TimingHistogram &_histogram;
+    uint64_t _start;
+
+    ScopedTimer ( const ScopedTimer & );
+    ScopedTimer &operator= ( const ScopedTimer & );
+};
+
+}
+
+#define ARUCO_TIMER_CAT2(a,b) a##b
+#define ARUCO_TIMER_CAT(a,b) ARUCO_TIMER_CAT2(a,b)
+
+///Times the rest of the enclosing block. The stage is looked up only once per call site
+#ifndef ARUCO_NO_TIMERS
+#define ARUCO_SCOPED_TIMER(name) \
+    static aruco::TimingHistogram &ARUCO_TIMER_CAT(_arucoHistogram,__LINE__)=aruco::Timers::get ( name ); \
+    aruco::ScopedTimer ARUCO_TIMER_CAT(_arucoTimer,__LINE__) ( ARUCO_TIMER_CAT(_arucoHistogram,__LINE__) )
+#else
+#define ARUCO_SCOPED_TIMER(name)
+#endif
+
+#endif
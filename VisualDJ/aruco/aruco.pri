@@ -0,0 +1,31 @@
+CONFIG += c++11
+
+INCLUDEPATH += $$PWD/..
+
+SOURCES += \
+           $$PWD/ar_threadpool.cpp \
+           $$PWD/ar_threshold.cpp \
+           $$PWD/ar_timers.cpp \
+           $$PWD/arucofidmarkers.cpp \
+           $$PWD/board.cpp \
+           $$PWD/boarddetector.cpp \
+           $$PWD/cameraparameters.cpp \
+           $$PWD/highlyreliablemarkers.cpp \
+           $$PWD/marker.cpp \
+           $$PWD/markerdetector.cpp \
+           $$PWD/subpixelcorner.cpp
+
+HEADERS += \
+           $$PWD/ar_threadpool.h \
+           $$PWD/ar_threshold.h \
+           $$PWD/ar_timers.h \
+           $$PWD/aruco.h \
+           $$PWD/arucofidmarkers.h \
+           $$PWD/board.h \
+           $$PWD/boarddetector.h \
+           $$PWD/cameraparameters.h \
+           $$PWD/exports.h \
+           $$PWD/highlyreliablemarkers.h \
+           $$PWD/marker.h \
+           $$PWD/markerdetector.h \
+           $$PWD/subpixelcorner.h
@@ -29,6 +29,9 @@ or implied, of Rafael Muñoz Salinas.
 */
 #include "arucofidmarkers.h"
 #include <cstdio>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
 #include <opencv2/imgproc/imgproc.hpp>
 using namespace cv;
 using namespace std;
@@ -271,66 +274,77 @@ cv::Mat  FiducidalMarkers::createBoardImage_Frame( Size gridSize,int MarkerSize,
  *
  *
  ************************************/
-Mat FiducidalMarkers::rotate(const Mat  &in)
+namespace {
+//The 5x5 inner bits of a marker are packed row by row: the cell (x,y) is the bit y*5+x
+const int CODE_BITS=25;
+
+//the code seen after turning the marker 90deg, out(y,x)=in(4-x,y)
+unsigned int rotateCode(unsigned int code)
 {
-    Mat out;
-    in.copyTo(out);
-    for (int i=0;i<in.rows;i++)
-    {
-        for (int j=0;j<in.cols;j++)
-        {
-            out.at<uchar>(i,j)=in.at<uchar>(in.cols-j-1,i);
-        }
-    }
+    unsigned int out=0;
+    for (int y=0;y<5;y++)
+        for (int x=0;x<5;x++)
+            if ((code>>((4-x)*5+y)) & 1) out|=1u<<(y*5+x);
     return out;
 }
 
-
-/************************************
- *
- *
- *
- *
- ************************************/
-int FiducidalMarkers::hammDistMarker(Mat  bits)
+/**Every code that is a marker in some rotation, the 1024 ids by 4 rotations, with the id and the
+ * rotations needed to see it in its position. Open addressing, with twice the slots it needs
+ */
+class MarkerCodeTable
 {
-    int ids[4][5]=
-    {
-        {
-            1,0,0,0,0
-        }
-        ,
-        {
-            1,0,1,1,1
-        }
-        ,
-        {
-            0,1,0,0,1
-        }
-        ,
-        {
-            0, 1, 1, 1, 0
+public:
+    MarkerCodeTable() {
+        for (int i=0;i<SLOTS;i++) _slots[i].code=EMPTY;
+        //the same words as getMarkerMat()
+        const int words[4]={0x10,0x17,0x09,0x0e};
+        for (int id=0;id<1024;id++) {
+            unsigned int code=0;
+            for (int y=0;y<5;y++) {
+                int word=words[(id>>2*(4-y)) & 0x0003];
+                for (int x=0;x<5;x++)
+                    if ((word>>(4-x)) & 1) code|=1u<<(y*5+x);
+            }
+            //turned k times, the marker needs 4-k turns to be back in its position
+            unsigned int seen=code;
+            for (int k=0;k<4;k++) {
+                insert(seen,id,(4-k)%4);
+                seen=rotateCode(seen);
+            }
         }
-    };
-    int dist=0;
-
-    for (int y=0;y<5;y++)
-    {
-        int minSum=1e5;
-        //hamming distance to each possible word
-        for (int p=0;p<4;p++)
-        {
-            int sum=0;
-            //now, count
-            for (int x=0;x<5;x++)
-                sum+=  bits.at<uchar>(y,x) == ids[p][x]?0:1;
-            if (minSum>sum) minSum=sum;
+    }
+    ///true if code is a marker. Symmetric codes get the fewest rotations
+    bool find(unsigned int code,int &id,int &nRotations)const {
+        for (unsigned int i=hash(code);;i=(i+1)&(SLOTS-1)) {
+            if (_slots[i].code==EMPTY) return false;
+            if (_slots[i].code==code) {
+                id=_slots[i].id;
+                nRotations=_slots[i].nRotations;
+                return true;
+            }
         }
-        //do the and
-        dist+=minSum;
     }
 
-    return dist;
+private:
+    static const int SLOTS=8192;
+    static const unsigned int EMPTY=0xffffffff;
+    struct Slot {
+        unsigned int code;
+        short id;
+        char nRotations;
+    };
+    Slot _slots[SLOTS];
+
+    static unsigned int hash(unsigned int code) {return (code*2654435761u)>>19;}
+    void insert(unsigned int code,int id,int nRotations) {
+        unsigned int i=hash(code);
+        while (_slots[i].code!=EMPTY && _slots[i].code!=code) i=(i+1)&(SLOTS-1);
+        if (_slots[i].code==code && _slots[i].nRotations<=nRotations) return;
+        _slots[i].code=code;
+        _slots[i].id=short(id);
+        _slots[i].nRotations=char(nRotations);
+    }
+};
 }
 
 /************************************
@@ -364,8 +378,7 @@ int FiducidalMarkers::analyzeMarkerImage(Mat &grey,int &nRotations)
     }
 
     //now,
-    vector<int> markerInfo(5);
-    Mat _bits=Mat::zeros(5,5,CV_8UC1);
+    unsigned int code=0;
     //get information(for each inner square, determine if it is  black or white)
 
     for (int y=0;y<5;y++)
@@ -377,48 +390,25 @@ int FiducidalMarkers::analyzeMarkerImage(Mat &grey,int &nRotations)
             int Ystart=(y+1)*(swidth);
             Mat square=grey(Rect(Xstart,Ystart,swidth,swidth));
             int nZ=countNonZero(square);
-            if (nZ> (swidth*swidth) /2)  _bits.at<uchar>( y,x)=1;
+            if (nZ> (swidth*swidth) /2)  code|=1u<<(y*5+x);
         }
     }
-// 		printMat<uchar>( _bits,"or mat");
-
-    //checkl all possible rotations
-    Mat _bitsFlip;
-    Mat Rotations[4];
-    Rotations[0]=_bits;
-    int dists[4];
-    dists[0]=hammDistMarker( Rotations[0]) ;
-    pair<int,int> minDist( dists[0],0);
-    for (int i=1;i<4;i++)
-    {
-        //rotate
-        Rotations[i]=rotate(Rotations[i-1]);
-        //get the hamming distance to the nearest possible word
-        dists[i]=hammDistMarker( Rotations[i]) ;
-        if (dists[i]<minDist.first)
-        {
-            minDist.first=  dists[i];
-            minDist.second=i;
-        }
-    }
-// 		        printMat<uchar>( Rotations [ minDist.second]);
-// 		 	cout<<"MinDist="<<minDist.first<<" "<<minDist.second<<endl;
-
-    nRotations=minDist.second;
-    if (minDist.first!=0)	 //FUTURE WORK: correct if any error
-        return -1;
-    else {//Get id of the marker
-        int MatID=0;
-        cv::Mat bits=Rotations [ minDist.second];
-        for (int y=0;y<5;y++)
-        {
-            MatID<<=1;
-            if ( bits.at<uchar>(y,1)) MatID|=1;
-            MatID<<=1;
-            if ( bits.at<uchar>(y,3)) MatID|=1;
-        }
-        return MatID;
-    }
+
+    return decodeBits(code,nRotations);
+}
+
+/**
+ * Id of the 5x5 inner bits of a marker, in the rotation that matches a valid marker. -1 if none does.
+ * Only exact matches are markers, so a lookup in the table of all the codes is enough
+ */
+int FiducidalMarkers::decodeBits(unsigned int code,int &nRotations)
+{
+    static const MarkerCodeTable table;
+    assert(code<(1u<<CODE_BITS));
+    int id;
+    nRotations=0;
+    if (!table.find(code,id,nRotations)) return -1; //FUTURE WORK: correct if any error
+    return id;
 }
 
 
@@ -500,6 +490,87 @@ int FiducidalMarkers::detect(const Mat &in,int &nRotations)
         return -1;*/
 }
 
+/**
+ *
+ */
+int FiducidalMarkers::detectInImage(const Mat &grey,const vector<Point2f> &corners,int &nRotations)
+{
+    assert(grey.type()==CV_8UC1 && corners.size()==4);
+    //homography from the grid, in cells, to the image. The one of the unit square in closed form
+    //(Heckbert), with the cells of the grid as the unit, the same getPerspectiveTransform gives
+    double x0=corners[0].x,y0=corners[0].y,x1=corners[1].x,y1=corners[1].y;
+    double x2=corners[2].x,y2=corners[2].y,x3=corners[3].x,y3=corners[3].y;
+    double dx1=x1-x2,dx2=x3-x2,dx3=x0-x1+x2-x3;
+    double dy1=y1-y2,dy2=y3-y2,dy3=y0-y1+y2-y3;
+    double det=dx1*dy2-dx2*dy1;
+    if (std::fabs(det)<1e-9) return -1;
+    double g=(dx3*dy2-dx2*dy3)/det,k=(dx1*dy3-dx3*dy1)/det;
+    const double h[9]={(x1-x0+g*x1)/7.,(x3-x0+k*x3)/7.,x0,
+                       (y1-y0+g*y1)/7.,(y3-y0+k*y3)/7.,y0,
+                       g/7.,k/7.,1.};
+
+    //3x3 points of each cell, away from its sides so that the blur of the edges does not count
+    const int nPoints=3;
+    uchar samples[7][7][nPoints*nPoints];
+    int histogram[256]={0};
+    for (int y=0;y<7;y++)
+        for (int x=0;x<7;x++)
+            for (int p=0;p<nPoints*nPoints;p++)
+            {
+                double u=x+(p%nPoints+1)/double(nPoints+1),v=y+(p/nPoints+1)/double(nPoints+1);
+                double w=h[6]*u+h[7]*v+h[8];
+                float ix=(h[0]*u+h[1]*v+h[2])/w,iy=(h[3]*u+h[4]*v+h[5])/w;
+                //bilinear interpolation, clamped to the image
+                ix=std::min(std::max(ix,0.f),float(grey.cols-1));
+                iy=std::min(std::max(iy,0.f),float(grey.rows-1));
+                int x0=int(ix),y0=int(iy);
+                int x1=std::min(x0+1,grey.cols-1),y1=std::min(y0+1,grey.rows-1);
+                float fx=ix-x0,fy=iy-y0;
+                const uchar *row0=grey.ptr<uchar>(y0),*row1=grey.ptr<uchar>(y1);
+                float value=(row0[x0]*(1-fx)+row0[x1]*fx)*(1-fy)+(row1[x0]*(1-fx)+row1[x1]*fx)*fy;
+                samples[y][x][p]=uchar(value+0.5f);
+                histogram[samples[y][x][p]]++;
+            }
+
+    //Otsu threshold of the samples, the same way threshold() computes it
+    const int nSamples=7*7*nPoints*nPoints;
+    double mu=0,q1=0,mu1=0,maxSigma=0;
+    int thres=0;
+    for (int i=0;i<256;i++) mu+=i*double(histogram[i]);
+    mu/=nSamples;
+    for (int i=0;i<256;i++)
+    {
+        double p_i=histogram[i]/double(nSamples);
+        mu1*=q1;
+        q1+=p_i;
+        double q2=1.-q1;
+        if (std::min(q1,q2)<FLT_EPSILON || std::max(q1,q2)>1.-FLT_EPSILON) continue;
+        mu1=(mu1+i*p_i)/q1;
+        double mu2=(mu-q1*mu1)/q2;
+        double sigma=q1*q2*(mu1-mu2)*(mu1-mu2);
+        if (sigma>maxSigma) {
+            maxSigma=sigma;
+            thres=i;
+        }
+    }
+
+    //a cell is white if most of its points are. The border should be entirely black
+    unsigned int code=0;
+    for (int y=0;y<7;y++)
+        for (int x=0;x<7;x++)
+        {
+            int nZ=0;
+            for (int p=0;p<nPoints*nPoints;p++)
+                if (samples[y][x][p]>thres) nZ++;
+            bool white=nZ>(nPoints*nPoints)/2;
+            if (y==0 || y==6 || x==0 || x==6) {
+                if (white) return -1;
+            }
+            else if (white) code|=1u<<((y-1)*5+x-1);
+        }
+    return decodeBits(code,nRotations);
+}
+
 vector<int> FiducidalMarkers::getListOfValidMarkersIds_random(int nMarkers,vector<int> *excluded) throw (cv::Exception)
 {
 
@@ -72,6 +72,16 @@ public:
      */
     static int detect(const cv::Mat &in,int &nRotations);
 
+    /** Detection of fiducidal aruco markers (10 bits) straight from the image, without warping the candidate.
+     * Only 3x3 points inside each cell of the 7x7 grid are read, through the homography given by the corners
+     * and with bilinear interpolation. They are thresholded with Otsu, as detect() does with the warped image
+     * @param grey CV_8UC1 image
+     * @param corners corners of the candidate in grey, in the order MarkerDetector::warp() maps them
+     * @param nRotations number of 90deg rotations in clockwise direction needed to set the marker in correct position
+     * @return -1 if the candidate is a not a valid marker, and its id in case it really is a marker
+     */
+    static int detectInImage(const cv::Mat &grey,const vector<cv::Point2f> &corners,int &nRotations);
+
     /**Similar to createMarkerImage. Instead of returning a visible image, returns a 8UC1 matrix of 0s and 1s with
      * the marker info
      */
@@ -127,9 +137,8 @@ public:
 private:
   
     static vector<int> getListOfValidMarkersIds_random(int nMarkers,vector<int> *excluded) throw (cv::Exception);
-    static  cv::Mat rotate(const cv::Mat & in);
-    static  int hammDistMarker(cv::Mat  bits);
     static  int analyzeMarkerImage(cv::Mat &grey,int &nRotations);
+    static  int decodeBits(unsigned int code,int &nRotations);
     static  bool correctHammMarker(cv::Mat &bits);
 };
 
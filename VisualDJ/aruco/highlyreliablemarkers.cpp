@@ -32,20 +32,16 @@ namespace aruco {
 
   // static variables from HighlyReliableMarkers. Need to be here to avoid linking errors
   Dictionary HighlyReliableMarkers::_D;
-  HighlyReliableMarkers::BalancedBinaryTree HighlyReliableMarkers::_binaryTree;
+  HighlyReliableMarkers::DictionaryIndex HighlyReliableMarkers::_index;
   unsigned int HighlyReliableMarkers::_n, HighlyReliableMarkers::_ncellsBorder, HighlyReliableMarkers::_correctionDistance;
-  int HighlyReliableMarkers::_swidth;
 
 
   /**
   */
   MarkerCode::MarkerCode(unsigned int n) {
-    // resize bits vectors and initialize to 0
-    for(unsigned int i=0; i<4; i++) {
-      _bits[i].resize(n*n); 
-      for(unsigned int j=0; j<_bits[i].size(); j++) _bits[i][j]=0;
-      _ids[i] = 0; // ids are also 0
-    }
+    if(n*n>64) throw cv::Exception(9001,"n*n>64","MarkerCode::MarkerCode",__FILE__,__LINE__);
+    // initialize bits to 0
+    for(unsigned int i=0; i<4; i++) _bits[i]=0;
     _n = n;
   };
   
@@ -54,10 +50,7 @@ namespace aruco {
    */
   MarkerCode::MarkerCode(const MarkerCode& MC)
   {
-    for(unsigned int i=0; i<4; i++) {
-      _bits[i] = MC._bits[i];
-      _ids[i] = MC._ids[i];
-    }
+    for(unsigned int i=0; i<4; i++) _bits[i] = MC._bits[i];
     _n = MC._n;
   }
 
@@ -75,19 +68,27 @@ namespace aruco {
 	else if(i==2) { y=n()-y-1; x=n()-x-1; }
     else if(i==3) { unsigned int aux=y; y=n()-x-1; x=aux; }
     unsigned int rotPos = y*n()+x; // calculate position in the unidimensional string
-	_bits[i][rotPos] = val; // modify value
-	// update identifier in that rotation
-    if(val==true) _ids[i] += (unsigned int)pow(float(2),float(rotPos)); // if 1, add 2^pos
-    else _ids[i] -= (unsigned int)pow(float(2),float(rotPos)); // if 0, substract 2^pos
+	// modify value, which also updates the identifier in that rotation
+    if(val==true) _bits[i] |= uint64_t(1)<<rotPos;
+    else _bits[i] &= ~(uint64_t(1)<<rotPos);
       }   
     }
   }
   
   
+  /**
+   */
+  std::vector<bool> MarkerCode::getRotation(unsigned int rot) {
+    std::vector<bool> bits(size());
+    for(unsigned int i=0; i<bits.size(); i++) bits[i]=get(i,rot);
+    return bits;
+  }
+  
+  
   /**
    */
   unsigned int MarkerCode::selfDistance(unsigned int &minRot) {
-    unsigned int res = _bits[0].size(); // init to n*n (max value)
+    unsigned int res = size(); // init to n*n (max value)
     for(unsigned int i=1; i<4; i++) { // self distance is not calculated for rotation 0
       unsigned int hammdist = hammingDistance(_bits[0], _bits[i]);
       if(hammdist<res) {
@@ -102,9 +103,9 @@ namespace aruco {
   /**
    */
   unsigned int MarkerCode::distance(MarkerCode m, unsigned int &minRot) {
-    unsigned int res = _bits[0].size(); // init to n*n (max value)
+    unsigned int res = size(); // init to n*n (max value)
     for(unsigned int i=0; i<4; i++) {
-      unsigned int hammdist = hammingDistance(_bits[0], m.getRotation(i));
+      unsigned int hammdist = hammingDistance(_bits[0], m._bits[i]);
       if(hammdist<res) {
 	minRot = i;
 	res = hammdist;
@@ -149,7 +150,7 @@ namespace aruco {
     // double for to go over all the cells
     for(unsigned int i=0; i<n(); i++) {
       for(unsigned int j=0; j<n(); j++) {
-	if(_bits[0][i*n()+j]!=0) { // just draw if it is 1, since the image has been init to 0
+	if(get(i*n()+j)) { // just draw if it is 1, since the image has been init to 0
 	  // double for to go over all the pixels in the cell
       for(unsigned int k=0; k<cellSize; k++) {
         for(unsigned int l=0; l<cellSize; l++) {
@@ -163,14 +164,6 @@ namespace aruco {
   }  
   
   
-  /**
-   */
-  unsigned int MarkerCode::hammingDistance(std::vector<bool> m1, std::vector<bool> m2) {
-    unsigned int res=0;
-    for(unsigned int i=0; i<m1.size(); i++)
-      if(m1[i]!=m2[i]) res++;
-    return res;
-  };  
   
   
   
@@ -269,7 +262,7 @@ namespace aruco {
     _ncellsBorder = (_D[0].n()+2);
     _correctionDistance = (unsigned int)floor( (_D.minimunDistance()-1)/2. ); //maximun correction distance
     
-    _binaryTree.loadDictionary(&D);   
+    _index.loadDictionary(&D);   
     
     return true;
     
@@ -293,37 +286,41 @@ namespace aruco {
     else cv::cvtColor(in,grey,CV_BGR2GRAY);
     //threshold image
     cv::threshold(grey, grey,125, 255, cv::THRESH_BINARY|cv::THRESH_OTSU);
-    _swidth=grey.rows/_ncellsBorder;    
+    // cell size is local so several detectors can run at once
+    int swidth=grey.rows/_ncellsBorder;    
     
     // check borders, even not necesary for the highly reliable markers
-    //if(!checkBorders(grey)) return -1; 
+    //if(!checkBorders(grey,swidth)) return -1; 
     
     // obtain inner code
-    MarkerCode candidate = getMarkerCode(grey);
+    MarkerCode candidate = getMarkerCode(grey,swidth);
 
-    // search each marker id in the balanced binary tree
+    // search each rotation of the code in the hash table
     unsigned int orgPos;
     for(unsigned int i=0; i<4; i++) {
-      if(_binaryTree.findId( candidate.getId(i), orgPos )) {
+      if(_index.findCode( candidate.getCode(i), orgPos )) {
 	  nRotations = i;
 	  return candidate.getId(i);
  	  //return orgPos;
       }
     }
     
-    // alternative version without using the balanced binary tree (less eficient)
-    //     for(uint i=0; i<_D.size(); i++) {
-    //       for(uint j=0; j<4; j++) {
-    // 	if(_D[i].getId() == candidate.getId(j)) {
-    // 	  nRotations = j;
-    // 	  return candidate.getId(j);
-    // 	}
-    //       }
-    //     }
-    
-    // correct errors
-    unsigned int minMarker, minRot;
-    if(_D.distance(candidate, minMarker, minRot) <= _correctionDistance) {
+    // correct errors: the nearest marker in any rotation, as Dictionary::distance() finds it.
+    // Ties go to the first marker of the dictionary, and then to the first rotation
+    bool found=false;
+    unsigned int minDist=0, minMarker=0, minRot=0;
+    for(unsigned int i=0; i<4; i++) {
+      unsigned int pos, dist;
+      if(_index.findNearest( candidate.getCode(i), _correctionDistance, pos, dist )) {
+	if(!found || dist<minDist || (dist==minDist && pos<minMarker)) {
+	  found=true;
+	  minDist=dist;
+	  minMarker=pos;
+	  minRot=i;
+	}
+      }
+    }
+    if(found) {
       nRotations = minRot;
       //return minMarker;
      return _D[minMarker].getId();
@@ -336,18 +333,18 @@ namespace aruco {
   
   /**
    */
-  bool HighlyReliableMarkers::checkBorders(cv::Mat grey) {
+  bool HighlyReliableMarkers::checkBorders(cv::Mat grey, int swidth) {
     for ( unsigned int y=0;y<_ncellsBorder;y++)
     {
         int inc=_ncellsBorder-1;
         if (y==0 || y==_ncellsBorder-1) inc=1;//for first and last row, check the whole border
         for ( unsigned int x=0;x<_ncellsBorder;x+=inc)
         {
-            int Xstart=(x)*(_swidth);
-            int Ystart=(y)*(_swidth);
-            cv::Mat square=grey(cv::Rect(Xstart,Ystart,_swidth,_swidth));
+            int Xstart=(x)*(swidth);
+            int Ystart=(y)*(swidth);
+            cv::Mat square=grey(cv::Rect(Xstart,Ystart,swidth,swidth));
             int nZ=cv::countNonZero(square);
-            if (nZ> (_swidth*_swidth) /2) {
+            if (nZ> (swidth*swidth) /2) {
                 return false;//can not be a marker because the border element is not black!
             }
         }
@@ -357,17 +354,17 @@ namespace aruco {
   
   /**
    */
-  MarkerCode HighlyReliableMarkers::getMarkerCode(cv::Mat grey) {
+  MarkerCode HighlyReliableMarkers::getMarkerCode(cv::Mat grey, int swidth) {
     MarkerCode candidate( _n );
     for (unsigned int y=0;y<_n;y++)
     {
         for (unsigned int x=0;x<_n;x++)
         {
-            int Xstart=(x+1)*(_swidth);
-            int Ystart=(y+1)*(_swidth);
-            cv::Mat square=grey(cv::Rect(Xstart,Ystart,_swidth,_swidth));
+            int Xstart=(x+1)*(swidth);
+            int Ystart=(y+1)*(swidth);
+            cv::Mat square=grey(cv::Rect(Xstart,Ystart,swidth,swidth));
             int nZ=countNonZero(square);
-            if (nZ> (_swidth*_swidth) /2)  candidate.set(y*_n+x, 1);
+            if (nZ> (swidth*swidth) /2)  candidate.set(y*_n+x, 1);
         }
      } 
      return candidate;
@@ -377,104 +374,87 @@ namespace aruco {
   
   /**
    */   
-  void HighlyReliableMarkers::BalancedBinaryTree::loadDictionary(Dictionary *D) {
-    // create _orderD wich is a sorted version of D
-    _orderD.clear();
-    for(unsigned int i=0; i<D->size(); i++) {
-      _orderD.push_back( std::pair<unsigned int,unsigned int>( (*D)[i].getId() ,i) );
-    }
-    std::sort(_orderD.begin(), _orderD.end());
-    
-    // calculate the number of levels of the tree 
-    unsigned int levels=0;
-    while( pow(float(2),float(levels)) <= _orderD.size() ) levels++;
-    //       levels-=1; // only count full levels
+  void HighlyReliableMarkers::DictionaryIndex::loadDictionary(Dictionary *D) {
+    _codes.resize(D->size());
+    for(unsigned int i=0; i<D->size(); i++) _codes[i]=(*D)[i].getCode();
     
-    // auxiliar vector to know which elements are already in the tree
-    std::vector<bool> visited;
-    visited.resize(_orderD.size());
-    for(unsigned int i=0; i<_orderD.size(); i++) visited[i]=false;
-    
-    // calculate position of the root element
-    unsigned int rootIdx = _orderD.size()/2;
-    visited[rootIdx] = true; // mark it as visited
-    
-    // auxiliar vector to store the ids intervals (max and min) during the creation of the tree
-    std::vector< std::pair<unsigned int, unsigned int> > intervals;
-    // first, add the two intervals at each side of root element
-    intervals.push_back( std::pair<unsigned int, unsigned int>(0,rootIdx) );
-    intervals.push_back( std::pair<unsigned int, unsigned int>(rootIdx,_orderD.size()) );
-
-    // init the tree
-    _binaryTree.clear();
-    _binaryTree.resize(_orderD.size());
+    // hash table with at least twice the slots as codes, a power of two
+    unsigned int bits=1;
+    while( (1u<<bits) < 2*_codes.size() ) bits++;
+    _hashShift = 64-bits;
+    _hashTable.assign(1u<<bits, -1);
+    for(unsigned int i=0; i<_codes.size(); i++) {
+      unsigned int slot=hashOf(_codes[i]);
+      while(_hashTable[slot]!=-1 && _codes[_hashTable[slot]]!=_codes[i]) slot=(slot+1)&(_hashTable.size()-1);
+      if(_hashTable[slot]==-1) _hashTable[slot]=i; // a repeated code keeps the first position
+    }
     
-    // add root information to the tree (make sure child do not coincide with self root for small sizes of D)
-    if(!visited[(0+rootIdx)/2]) _binaryTree[rootIdx].first = (0+rootIdx)/2;
-    else _binaryTree[rootIdx].first = -1;
-    if(!visited[(rootIdx+_orderD.size())/2]) _binaryTree[rootIdx].second = (rootIdx+_orderD.size())/2;
-    else _binaryTree[rootIdx].second = -1;
-	    
-    // for each tree level
-    for(unsigned int i=1; i<levels; i++) {
-      unsigned int nintervals = intervals.size(); // count number of intervals and process them
-      for(unsigned int j=0; j<nintervals; j++) {
-	// store interval information and delete it
-    unsigned int lowerBound, higherBound;
-	lowerBound = intervals.back().first;
-	higherBound = intervals.back().second;
-	intervals.pop_back();
-	
-	// center of the interval
-    unsigned int center = (higherBound + lowerBound)/2;
-	
-	// if center not visited, continue
-	if(!visited[center])	visited[center]=true;
-	else continue;
-	
-	// calculate centers of the child intervals
-    unsigned int lowerChild = (lowerBound + center)/2;
-    unsigned int higherChild = (center + higherBound)/2;
-	
-	// if not visited (lower child)
-	if(!visited[lowerChild]) {
-      intervals.insert( intervals.begin(), std::pair<unsigned int, unsigned int>(lowerBound, center) ); // add the interval to analyze later
-	  _binaryTree[center].first = lowerChild; // add as a child in the tree
-	}
-	else _binaryTree[center].first = -1; // if not, mark as no child
-
-	// (higher child, same as lower child)
-	if(!visited[higherChild]) {
-      intervals.insert( intervals.begin(), std::pair<unsigned int, unsigned int>(center, higherBound) );
-	  _binaryTree[center].second = higherChild;
-	}
-	else _binaryTree[center].second = -1;
-	
+    // BK-tree: the children of a node are kept by their distance to it, each distance once
+    _tree.clear();
+    for(unsigned int i=0; i<_codes.size(); i++) {
+      Node node;
+      node.pos=i;
+      node.distance=0;
+      node.firstChild=node.nextSibling=-1;
+      if(_tree.empty()) {
+	_tree.push_back(node);
+	continue;
       }
-    }      
-    
-    // print tree
-    // for(uint i=0; i<_binaryTree.size(); i++) std::cout << _binaryTree[i].first << " " << _binaryTree[i].second << std::endl;
-    // std::cout << std::endl;
-    
+      int parent=0;
+      while(true) {
+	node.distance=MarkerCode::hammingDistance(_codes[i], _codes[_tree[parent].pos]);
+	int child=_tree[parent].firstChild;
+	while(child!=-1 && _tree[child].distance!=node.distance) child=_tree[child].nextSibling;
+	if(child==-1) break;
+	parent=child;
+      }
+      node.nextSibling=_tree[parent].firstChild;
+      _tree[parent].firstChild=_tree.size();
+      _tree.push_back(node);
+    }
   };   
   
   
   /**
    */     
-  bool HighlyReliableMarkers::BalancedBinaryTree::findId(unsigned int id, unsigned int &orgPos) {
-    unsigned int pos = _root; // first position is root
-    while(pos!=-1) { // while having a valid position
-      unsigned int posId = _orderD[pos].first; // calculate id of the node
-      if(posId == id ) {
-	orgPos = _orderD[pos].second;
-	return true; // if is the desire id, return true
+  bool HighlyReliableMarkers::DictionaryIndex::findCode(uint64_t code, unsigned int &orgPos) const {
+    if(_hashTable.empty()) return false;
+    for(unsigned int slot=hashOf(code); _hashTable[slot]!=-1; slot=(slot+1)&(_hashTable.size()-1)) {
+      if(_codes[_hashTable[slot]]==code) {
+	orgPos = _hashTable[slot];
+	return true;
       }
-      else if(posId < id) pos = _binaryTree[pos].second; // if desired id is higher, look in higher child
-      else pos = _binaryTree[pos].first; // if it is lower, look in lower child
     }
     return false; // if nothing found, return false
   }
   
   
+  /**
+   */     
+  bool HighlyReliableMarkers::DictionaryIndex::findNearest(uint64_t code, unsigned int maxDistance, unsigned int &orgPos, unsigned int &distance) const {
+    if(_tree.empty()) return false;
+    bool found=false;
+    unsigned int radius=maxDistance;
+    // nodes to visit. A child at distance d of its parent can only have codes within the radius
+    // if d is within the radius of the distance from code to the parent
+    std::vector<int> pending(1,0);
+    while(!pending.empty()) {
+      const Node &node=_tree[pending.back()];
+      pending.pop_back();
+      unsigned int dist=MarkerCode::hammingDistance(code, _codes[node.pos]);
+      if(dist<=radius && (!found || dist<distance || (dist==distance && node.pos<orgPos))) {
+	found=true;
+	distance=dist;
+	orgPos=node.pos;
+	radius=dist; // only as near or nearer codes matter now
+      }
+      for(int child=node.firstChild; child!=-1; child=_tree[child].nextSibling) {
+	unsigned int d=_tree[child].distance;
+	if(d+radius>=dist && d<=dist+radius) pending.push_back(child);
+      }
+    }
+    return found;
+  }
+  
+  
 };
@@ -33,6 +33,7 @@ or implied, of Rafael Muñoz Salinas.
 #include <vector>
 #include <math.h>
 #include <string>
+#include <stdint.h>
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include "exports.h"
@@ -44,13 +45,13 @@ namespace aruco {
 /**
  * This class represent the internal code of a marker
  * It does not include marker borders
- * 
+ * The bits of each rotation are packed in a 64 bits integer, so n can be 8 at most
  */
 class ARUCO_EXPORTS MarkerCode {
 public:
   
   /**
-   * Constructor, receive dimension of marker
+   * Constructor, receive dimension of marker. Throws if n*n is over 64
    */
   MarkerCode(unsigned int n=0);
   
@@ -63,7 +64,14 @@ public:
    * Get id of a specific rotation as the number obtaiend from the concatenation of all the bits
    */
   unsigned int getId(unsigned int rot=0)  {
-      return _ids[rot];
+      return (unsigned int)_bits[rot];
+  }
+  
+  /**
+   * Get the bits of a specific rotation, the bit pos is the cell pos=y*n+x
+   */
+  uint64_t getCode(unsigned int rot=0) const {
+      return _bits[rot];
   }
   
   /**
@@ -71,15 +79,13 @@ public:
    * The marker is refered as a unidimensional string of bits, i.e. pos=y*n+x
    */
   bool get(unsigned int pos, unsigned int rot=0)  {
-      return _bits[rot][pos];
+      return (_bits[rot]>>pos) & 1;
   }
   
   /**
    * Get the string of bits for a specific rotation
    */
-  std::vector<bool> getRotation(unsigned int rot)  {
-      return _bits[rot];
-  }
+  std::vector<bool> getRotation(unsigned int rot);
   
   /**
    * Set the value of a vit in a specific rotation
@@ -152,15 +158,24 @@ public:
    */
   cv::Mat getImg(unsigned int pixSize);
   
-private:
-  unsigned int _ids[4]; // ids in the four rotations
-  std::vector<bool> _bits[4]; // bit strings in the four rotations
-  unsigned int _n; // marker dimension
-  
   /**
-   * Return hamming distance between two bit vectors
+   * Return hamming distance between two packed codes
    */
-  unsigned int hammingDistance(std::vector<bool> m1, std::vector<bool> m2);
+  static unsigned int hammingDistance(uint64_t m1, uint64_t m2) {
+#ifdef __GNUC__
+      return __builtin_popcountll(m1^m2);
+#else
+      uint64_t x=m1^m2;
+      x=x-((x>>1)&0x5555555555555555ULL);
+      x=(x&0x3333333333333333ULL)+((x>>2)&0x3333333333333333ULL);
+      x=(x+(x>>4))&0x0f0f0f0f0f0f0f0fULL;
+      return (unsigned int)((x*0x0101010101010101ULL)>>56);
+#endif
+  }
+  
+private:
+  uint64_t _bits[4]; // bits in the four rotations, the id of each rotation
+  unsigned int _n; // marker dimension
   
 };
 
@@ -227,34 +242,45 @@ class ARUCO_EXPORTS HighlyReliableMarkers
 public:
   
   /**
-  * Balanced Binary Tree for a marker dictionary
+  * Index of the codes of a marker dictionary: a hash table for the exact matches, and a BK-tree,
+  * a tree that splits the codes by their Hamming distance, for the nearest code within a distance
   *
   */
-  class BalancedBinaryTree {
+  class DictionaryIndex {
     
   public:
        
     /**
-    * Create the tree for dictionary D
+    * Create the index for dictionary D
     */
     void loadDictionary(Dictionary *D);
     
     /**
-    * Search a id in the dictionary. Return true if found, false otherwise.
+    * Search a code in the dictionary. Return true if found, false otherwise.
+    */
+    bool findCode(uint64_t code, unsigned int &orgPos) const;
+    
+    /**
+    * Search the nearest code of the dictionary, if it is at maxDistance or less. Return true if found, false otherwise.
+    * If several codes are at the same distance, orgPos is the first one in the dictionary
     */
-    bool findId(unsigned int id, unsigned int &orgPos);
+    bool findNearest(uint64_t code, unsigned int maxDistance, unsigned int &orgPos, unsigned int &distance) const;
    
   private:
 
-    std::vector< std::pair<unsigned int,unsigned int> > _orderD; // dictionary sorted by id,
-						 // first element is the id, 
-						 // second element is the position in original D
-    std::vector< std::pair<int, int> > _binaryTree; // binary tree itself (as a vector), each element is a node of the tree
-						      // first element indicate the position in _binaryTree of the lower child
-						      // second element is the position in _binaryTree of the higher child
-						      // -1 value indicates no lower or higher child
-    unsigned int _root; // position in _binaryTree of the root node of the tree
+    std::vector<uint64_t> _codes; // rotation 0 of each marker, in the order of D
+    std::vector<int> _hashTable; // open addressing, position in D of the code, -1 if empty
+    unsigned int _hashShift;
+    struct Node {
+      unsigned int pos; // position in D
+      unsigned int distance; // distance to the parent node
+      int firstChild, nextSibling; // positions in _tree, -1 if none
+    };
+    std::vector<Node> _tree; // BK-tree, the root is the first node
     
+    unsigned int hashOf(uint64_t code) const {
+      return (unsigned int)((code*0x9E3779B97F4A7C15ULL)>>_hashShift);
+    }
   };
   
   /**
@@ -278,23 +304,22 @@ public:
   
 private:
   static Dictionary _D; // loaded dictionary
-  static BalancedBinaryTree _binaryTree;
+  static DictionaryIndex _index;
   // marker dimension, marker dimension with borders, maximunCorrectionDistance
   static unsigned int _n;
   static unsigned int _ncellsBorder;
   static unsigned int _correctionDistance;
-  static int _swidth; // cell size in the canonical image
   
   
   /**
    * Check marker borders cell in the canonical image are black
    */
-  static bool checkBorders(cv::Mat grey);
+  static bool checkBorders(cv::Mat grey, int swidth);
   
   /**
    * Return binary MarkerCode from a canonical image, it ignores borders
    */
-  static MarkerCode getMarkerCode(cv::Mat grey);
+  static MarkerCode getMarkerCode(cv::Mat grey, int swidth);
    
   
 };
@@ -35,7 +35,11 @@ or implied, of Rafael Muñoz Salinas.
 #include <fstream>
 #include "arucofidmarkers.h"
 #include <valarray>
-#include "ar_omp.h"
+#include <algorithm>
+#include <limits>
+#include "ar_threadpool.h"
+#include "ar_timers.h"
+#include "ar_threshold.h"
 using namespace std;
 using namespace cv;
   
@@ -50,6 +54,7 @@ namespace aruco
 MarkerDetector::MarkerDetector()
 {
     _doErosion=false; 
+    _cellSampling=true;
     _thresMethod=ADPT_THRES;
     _thresParam1=_thresParam2=7;
     _cornerMethod=LINES;
@@ -57,10 +62,27 @@ MarkerDetector::MarkerDetector()
     _speed=0;
     markerIdDetector_ptrfunc=aruco::FiducidalMarkers::detect;
     pyrdown_level=0; // no image reduction
+    _autoMinMarkerPixels=0;
+    _autoMaxLevel=0;
+    _autoFrames=0;
+    _identityCacheFrames=10;
+    _identityCacheMaxMove=2;
+    _cacheFrame=0;
+    _explicitFrames=false;
+    _minBorderContrast=20;
+    resetRejections();
     _minSize=0.04;
     _maxSize=0.5;
 
   _borderDistThres=0.01;//corners in a border of 1% of image  are ignored
+    _nRectangles=0;
+    _nMarkerCandidates=0;
+    _refineLevel=0;
+    _poseMarkerSize=-1;
+    _poseYPerpendicular=false;
+    _parallelContours=true;
+    _serialContourFrames=0;
+    _workspaceGrowths=0;
 }
 /************************************
  *
@@ -123,7 +145,7 @@ void MarkerDetector::detect ( const  cv::Mat &input,std::vector<Marker> &detecte
  ************************************/
 void MarkerDetector::detect ( const  cv::Mat &input,vector<Marker> &detectedMarkers,Mat camMatrix ,Mat distCoeff ,float markerSizeMeters ,bool setYPerpendicular) throw ( cv::Exception )
 {
-
+    ARUCO_SCOPED_TIMER ( "MarkerDetector::detect" );
 
     //it must be a 3 channel image
     if ( input.type() ==CV_8UC3 )   cv::cvtColor ( input,grey,CV_BGR2GRAY );
@@ -132,21 +154,19 @@ void MarkerDetector::detect ( const  cv::Mat &input,vector<Marker> &detectedMark
 
 //     cv::cvtColor(grey,_ssImC ,CV_GRAY2BGR); //DELETE
 
-    //clear input data
-    detectedMarkers.clear();
-
-
+    nextPyrDownLevel();
     cv::Mat imgToBeThresHolded=grey;
     double ThresParam1=_thresParam1,ThresParam2=_thresParam2;
     //Must the image be downsampled before continue pocessing?
     if ( pyrdown_level!=0 )
     {
+        //each level has its own buffer, so they are not reallocated on every frame
+        if ( _pyramid.size() <size_t ( pyrdown_level ) ) _pyramid.resize ( pyrdown_level );
         reduced=grey;
         for ( int i=0;i<pyrdown_level;i++ )
         {
-            cv::Mat tmp;
-            cv::pyrDown ( reduced,tmp );
-            reduced=tmp;
+            cv::pyrDown ( reduced,_pyramid[i] );
+            reduced=_pyramid[i];
         }
         int red_den=pow ( 2.0f,pyrdown_level );
         imgToBeThresHolded=reduced;
@@ -163,113 +183,477 @@ void MarkerDetector::detect ( const  cv::Mat &input,vector<Marker> &detectedMark
         thres2.copyTo(thres); //vs thres=thres2;
     }
     //find all rectangles in the thresholdes image
-    vector<MarkerCandidate > MarkerCanditates;
-    detectRectangles ( thres,MarkerCanditates );
+    findCandidates ( thres );
     //if the image has been downsampled, then calcualte the location of the corners in the original image
-    if ( pyrdown_level!=0 )
+    if ( pyrdown_level!=0 ) scaleCandidates ( pyrdown_level );
+
+    finishDetection ( detectedMarkers,camMatrix,distCoeff,markerSizeMeters,setYPerpendicular,pyrdown_level );
+    if ( _autoMinMarkerPixels>0 ) recordMarkerSides ( detectedMarkers );
+}
+
+
+/************************************
+ *
+ * Automatic pyrDown() level
+ *
+ *
+ ************************************/
+unsigned int MarkerDetector::nextPyrDownLevel()
+{
+    if ( _autoMinMarkerPixels>0 ) pyrdown_level=autoPyrDownLevel();
+    return pyrdown_level;
+}
+
+int MarkerDetector::autoPyrDownLevel()
+{
+    //full resolution from time to time, and until there is a history
+    if ( _autoFrames%AUTO_PYRDOWN_FRAMES==0 ) return 0;
+    float minSide=std::numeric_limits<float>::max();
+    for ( unsigned int i=0;i<std::min ( _autoFrames,unsigned ( AUTO_PYRDOWN_FRAMES ) );i++ )
     {
-        float red_den=pow ( 2.0f,pyrdown_level );
-        float offInc= ( ( pyrdown_level/2. )-0.5 );
-        for ( unsigned int i=0;i<MarkerCanditates.size();i++ ) {
-            for ( unsigned int c=0;c<4;c++ )
-            {
-                MarkerCanditates[i][c].x=MarkerCanditates[i][c].x*red_den+offInc;
-                MarkerCanditates[i][c].y=MarkerCanditates[i][c].y*red_den+offInc;
-            }
-            //do the same with the the contour points
-            for ( unsigned int c=0;c<MarkerCanditates[i].contour.size();c++ )
-            {
-                MarkerCanditates[i].contour[c].x=MarkerCanditates[i].contour[c].x*red_den+offInc;
-                MarkerCanditates[i].contour[c].y=MarkerCanditates[i].contour[c].y*red_den+offInc;
-            }
+        //a frame without markers may have missed small ones
+        if ( _recentMinSides[i]==0 ) return 0;
+        minSide=std::min ( minSide,_recentMinSides[i] );
+    }
+    int level=0;
+    while ( level<int ( _autoMaxLevel ) && minSide/float ( 2<<level ) >=_autoMinMarkerPixels ) level++;
+    return level;
+}
+
+void MarkerDetector::recordMarkerSides ( const std::vector<Marker> &markers )
+{
+    float minSide=0;
+    for ( size_t i=0;i<markers.size();i++ )
+        for ( int c=0;c<4;c++ )
+        {
+            float side=cv::norm ( markers[i][c]-markers[i][ ( c+1 ) %4] );
+            if ( minSide==0 || side<minSide ) minSide=side;
         }
+    _recentMinSides[_autoFrames%AUTO_PYRDOWN_FRAMES]=minSide;
+    _autoFrames++;
+}
+
+
+/************************************
+ *
+ * Detection on an image the caller already converted and thresholded
+ *
+ *
+ ************************************/
+void MarkerDetector::detectThresholded ( const cv::Mat &greyImg,const cv::Mat &thresImg,std::vector<Marker> &detectedMarkers,CameraParameters camParams,float markerSizeMeters,bool setYPerpendicular ) throw ( cv::Exception )
+{
+    detectThresholded ( greyImg,thresImg,detectedMarkers,camParams.CameraMatrix,camParams.Distorsion,markerSizeMeters,setYPerpendicular );
+}
+
+void MarkerDetector::detectThresholded ( const cv::Mat &greyImg,const cv::Mat &thresImg,vector<Marker> &detectedMarkers,Mat camMatrix,Mat distCoeff,float markerSizeMeters,bool setYPerpendicular ) throw ( cv::Exception )
+{
+    detectThresholdedLevel ( greyImg,thresImg,0,detectedMarkers,camMatrix,distCoeff,markerSizeMeters,setYPerpendicular );
+}
+
+void MarkerDetector::detectThresholded ( const cv::Mat &greyImg,const cv::Mat &thresImg,unsigned int thresLevel,std::vector<Marker> &detectedMarkers,CameraParameters camParams,float markerSizeMeters,bool setYPerpendicular ) throw ( cv::Exception )
+{
+    detectThresholdedLevel ( greyImg,thresImg,thresLevel,detectedMarkers,camParams.CameraMatrix,camParams.Distorsion,markerSizeMeters,setYPerpendicular );
+}
+
+void MarkerDetector::detectThresholdedLevel ( const cv::Mat &greyImg,const cv::Mat &thresImg,unsigned int thresLevel,std::vector<Marker> &detectedMarkers,const cv::Mat &camMatrix,const cv::Mat &distCoeff,float markerSizeMeters,bool setYPerpendicular )
+{
+    ARUCO_SCOPED_TIMER ( "MarkerDetector::detectThresholded" );
+
+    //each pyrDown() halves the sides rounding up
+    int reduction=1<<thresLevel;
+    cv::Size reducedSize ( ( greyImg.cols+reduction-1 ) /reduction, ( greyImg.rows+reduction-1 ) /reduction );
+    if ( greyImg.type() !=CV_8UC1 )     throw cv::Exception ( 9001,"greyImg.type()!=CV_8UC1","MarkerDetector::detectThresholded",__FILE__,__LINE__ );
+    if ( thresImg.type() !=CV_8UC1 || thresImg.size() !=reducedSize )
+        throw cv::Exception ( 9001,"thresImg must be CV_8UC1 and of the size of greyImg reduced thresLevel times","MarkerDetector::detectThresholded",__FILE__,__LINE__ );
+
+    //no conversion, no pyramid and no thresHold, the images are used as they are.
+    //thres is not made to point to thresImg, a later detect() would write into the caller image
+    grey=greyImg;
+    if ( _doErosion )
+    {
+        erode ( thresImg,thres,cv::Mat() );
+        findCandidates ( thres );
     }
+    else findCandidates ( thresImg );
+    if ( thresLevel>0 ) scaleCandidates ( thresLevel );
+    finishDetection ( detectedMarkers,camMatrix,distCoeff,markerSizeMeters,setYPerpendicular,thresLevel );
+
+    //the regions of a frame do not count for the automatic level, only the whole image
+    cv::Size wholeSize;
+    cv::Point offset;
+    grey.locateROI ( wholeSize,offset );
+    if ( _autoMinMarkerPixels>0 && wholeSize==grey.size() ) recordMarkerSides ( detectedMarkers );
+}
+
+
+/************************************
+ *
+ * Candidates found in a reduced image, to the full resolution one
+ *
+ *
+ ************************************/
+void MarkerDetector::scaleCandidates ( int level )
+{
+    float red_den=pow ( 2.0f,level );
+    float offInc= ( ( level/2. )-0.5 );
+    for ( unsigned int i=0;i<_nMarkerCandidates;i++ ) {
+        for ( unsigned int c=0;c<4;c++ )
+        {
+            _markerCandidates[i][c].x=_markerCandidates[i][c].x*red_den+offInc;
+            _markerCandidates[i][c].y=_markerCandidates[i][c].y*red_den+offInc;
+        }
+        //do the same with the the contour points
+        for ( unsigned int c=0;c<_markerCandidates[i].contour.size();c++ )
+        {
+            _markerCandidates[i].contour[c].x=_markerCandidates[i].contour[c].x*red_den+offInc;
+            _markerCandidates[i].contour[c].y=_markerCandidates[i].contour[c].y*red_den+offInc;
+        }
+    }
+}
+
+
+/************************************
+ *
+ * Steps shared by both entry points, once the candidates are in _markerCandidates
+ *
+ *
+ ************************************/
+void MarkerDetector::finishDetection ( std::vector<Marker> &detectedMarkers,const cv::Mat &camMatrix,const cv::Mat &distCoeff,float markerSizeMeters,bool setYPerpendicular,int pyrLevel )
+{
+    //the known markers are in the coordinates of the whole image, grey may be a region of it
+    cv::Size wholeSize;
+    grey.locateROI ( wholeSize,_greyOffset );
+    if ( wholeSize!=_knownImageSize ) _knownMarkers.clear();
+    _knownImageSize=wholeSize;
+    if ( !_explicitFrames ) _cacheFrame++;
 
-    
     ///identify the markers
-    vector<vector<Marker> >markers_omp(omp_get_max_threads());
-    vector<vector < std::vector<cv::Point2f> > >candidates_omp(omp_get_max_threads());
-    #pragma omp parallel for
-    for ( unsigned int i=0;i<MarkerCanditates.size();i++ )
+    identifyCandidates ( camMatrix,distCoeff );
+    _candidates.clear();//filled on demand by getCandidates()
+
+    //their corners as found, for the next calls, before the refinement moves them
+    if ( _identityCacheFrames>0 )
     {
-        //Find proyective homography
-        Mat canonicalMarker;
-        bool resW=false;
-     	resW=warp ( grey,canonicalMarker,Size ( _markerWarpSize,_markerWarpSize ),MarkerCanditates[i] );
-        if (resW) {
-             int nRotations;
-            int id= ( *markerIdDetector_ptrfunc ) ( canonicalMarker,nRotations );
-            if ( id!=-1 )
-            {
- 		if(_cornerMethod==LINES) // make LINES refinement before lose contour points
-		  refineCandidateLines( MarkerCanditates[i], camMatrix, distCoeff ); 
-                markers_omp[omp_get_thread_num()].push_back ( MarkerCanditates[i] );
-                markers_omp[omp_get_thread_num()].back().id=id;
-                //sort the points so that they are always in the same order no matter the camera orientation
-                std::rotate ( markers_omp[omp_get_thread_num()].back().begin(),markers_omp[omp_get_thread_num()].back().begin() +4-nRotations,markers_omp[omp_get_thread_num()].back().end() );
-            }
-            else candidates_omp[omp_get_thread_num()].push_back ( MarkerCanditates[i] );
+        assignWorkspace ( _newKnownMarkers,_found.size(),KnownMarker() );
+        for ( size_t i=0;i<_found.size();i++ )
+        {
+            KnownMarker &known=_newKnownMarkers[i];
+            for ( int c=0;c<4;c++ ) known.corners[c]=_markerCandidates[_found[i].candidate][c]+cv::Point2f ( _greyOffset );
+            known.id=_found[i].id;
+            known.decodedFrame=_found[i].decodedFrame;
         }
-       
     }
-    //unify parallel data 
-	joinVectors(markers_omp,detectedMarkers,true);
-	joinVectors(candidates_omp,_candidates,true);
 
 
 
     ///refine the corner location if desired
-    if ( detectedMarkers.size() >0 && _cornerMethod!=NONE && _cornerMethod!=LINES )
+    //the corners found in a reduced image are only as precise as its pixels, so they are always refined
+    //in the full resolution one, with a window as large as the reduction
+    bool fromReduced=pyrLevel>0 && _cornerMethod!=NONE;
+    bool refine=fromReduced || ( _cornerMethod!=NONE && _cornerMethod!=LINES );
+    ///and find the position of each marker if desired
+    bool poses=camMatrix.rows!=0  && markerSizeMeters>0;
+    //a graph with a chain per marker, so a marker is placed as soon as its corners are refined, while
+    //the others are still refining. The markers removed below are placed too, but they are rare
+    _taskGraph.clear();
+    //each pose has its own matrices, a copy of a Marker would share them
+    for ( size_t i=_poses.size();poses && i<_found.size();i++ )
+    {
+        _poses.push_back ( Marker() );
+        _workspaceGrowths++;
+    }
+    //the tasks only take the index, the rest is here. std::function keeps so small a task in place, with no allocation
+    _refineLevel=fromReduced?pyrLevel:0;
+    _poseCamMatrix=camMatrix;
+    _poseDistCoeff=distCoeff;
+    _poseMarkerSize=markerSizeMeters;
+    _poseYPerpendicular=setYPerpendicular;
+    for ( int i=0;i<int ( _found.size() ) && ( refine || poses );i++ )
     {
-        vector<Point2f> Corners;
-        for ( unsigned int i=0;i<detectedMarkers.size();i++ )
-            for ( int c=0;c<4;c++ )
-                Corners.push_back ( detectedMarkers[i][c] );
-
-        if ( _cornerMethod==HARRIS )
-            findBestCornerInRegion_harris ( grey, Corners,7 );
-        else if ( _cornerMethod==SUBPIX )
-            cornerSubPix ( grey, Corners,cvSize ( 5,5 ), cvSize ( -1,-1 )   ,cvTermCriteria ( CV_TERMCRIT_ITER|CV_TERMCRIT_EPS,3,0.05 ) );
-
-        //copy back
-        for ( unsigned int i=0;i<detectedMarkers.size();i++ )
-            for ( int c=0;c<4;c++ )     detectedMarkers[i][c]=Corners[i*4+c];
+        int refineTask=-1;
+        if ( refine )
+            refineTask=_taskGraph.add ( [this,i] {refineCorners ( _markerCandidates[_found[i].candidate],_refineLevel );} );
+        if ( poses )
+        {
+            int poseTask=_taskGraph.add ( [this,i] {
+                Marker &pose=_poses[i];
+                static_cast<vector<cv::Point2f> &> ( pose ) =_markerCandidates[_found[i].candidate];
+                pose.id=_found[i].id;
+                pose.calculateExtrinsics ( _poseMarkerSize,_poseCamMatrix,_poseDistCoeff,_poseYPerpendicular );
+            } );
+            if ( refineTask!=-1 ) _taskGraph.addDependency ( refineTask,poseTask );
+        }
     }
-    //sort by id
-    std::sort ( detectedMarkers.begin(),detectedMarkers.end() );
+    _taskGraph.run();
+    //_found is sorted by id. Only the indices are moved, the markers are written once at the end
     //there might be still the case that a marker is detected twice because of the double border indicated earlier,
     //detect and remove these cases
-    int borderDistThresX=_borderDistThres*float(input.cols);
-    int borderDistThresY=_borderDistThres*float(input.rows);
-    vector<bool> toRemove ( detectedMarkers.size(),false );
-    for ( int i=0;i<int ( detectedMarkers.size() )-1;i++ )
+    int borderDistThresX=_borderDistThres*float(grey.cols);
+    int borderDistThresY=_borderDistThres*float(grey.rows);
+    assignWorkspace ( _toRemove,_found.size(),char ( false ) );
+    for ( int i=0;i<int ( _found.size() )-1;i++ )
     {
-        if ( detectedMarkers[i].id==detectedMarkers[i+1].id && !toRemove[i+1] )
+        MarkerCandidate &marker=_markerCandidates[_found[i].candidate];
+        if ( _found[i].id==_found[i+1].id && !_toRemove[i+1] )
         {
             //deletes the one with smaller perimeter
-            if ( perimeter ( detectedMarkers[i] ) >perimeter ( detectedMarkers[i+1] ) ) toRemove[i+1]=true;
-            else toRemove[i]=true;
+            if ( perimeter ( marker ) >perimeter ( _markerCandidates[_found[i+1].candidate] ) ) _toRemove[i+1]=true;
+            else _toRemove[i]=true;
         }
-        //delete if any of the corners is too near image border
-        for(size_t c=0;c<detectedMarkers[i].size();c++){
-	    if ( detectedMarkers[i][c].x<borderDistThresX ||
-	      detectedMarkers[i][c].y<borderDistThresY || 
-	      detectedMarkers[i][c].x>input.cols-borderDistThresX ||
-	      detectedMarkers[i][c].y>input.rows-borderDistThresY ) toRemove[i]=true;
+        //delete if any of the corners is too near image border. The candidates were checked before
+        //decoding, this is for the corners the refinement moved
+        for(size_t c=0;c<marker.size();c++){
+	    if ( marker[c].x<borderDistThresX ||
+	      marker[c].y<borderDistThresY || 
+	      marker[c].x>grey.cols-borderDistThresX ||
+	      marker[c].y>grey.rows-borderDistThresY ) _toRemove[i]=true;
 
 	}
  
         
     }
-    //remove the markers marker
-    removeElements ( detectedMarkers, toRemove );
+    //the markers kept replace the known ones of this region. Those of the rest of the image are for the other
+    //calls of the frame, unless their id is too old to be reused anyway
+    size_t nKnown=0;
+    cv::Rect region ( _greyOffset,grey.size() );
+    for ( size_t k=0;k<_knownMarkers.size() && _identityCacheFrames>0;k++ )
+    {
+        const KnownMarker &known=_knownMarkers[k];
+        cv::Point2f center= ( known.corners[0]+known.corners[1]+known.corners[2]+known.corners[3] ) *0.25f;
+        if ( !region.contains ( center ) && _cacheFrame-known.decodedFrame<_identityCacheFrames ) _knownMarkers[nKnown++]=known;
+    }
+    _knownMarkers.resize ( nKnown );
+    for ( size_t i=0;i<_newKnownMarkers.size() && _identityCacheFrames>0;i++ )
+        if ( !_toRemove[i] ) pushBack ( _knownMarkers,_newKnownMarkers[i],_workspaceGrowths );
+    //write the remaining markers in the output, reusing the markers it already had
+    size_t nDetected=0;
+    for ( size_t i=0;i<_found.size();i++ )
+        if ( !_toRemove[i] ) nDetected++;
+    detectedMarkers.resize ( nDetected );
+    for ( size_t i=0,d=0;i<_found.size();i++ )
+    {
+        if ( _toRemove[i] ) continue;
+        Marker &marker=detectedMarkers[d++];
+        static_cast<vector<cv::Point2f> &> ( marker ) =_markerCandidates[_found[i].candidate];
+        marker.id=_found[i].id;
+        //copied, the poses are overwritten by the next frame
+        if ( poses )
+        {
+            _poses[i].Rvec.copyTo ( marker.Rvec );
+            _poses[i].Tvec.copyTo ( marker.Tvec );
+            marker.ssize=_poses[i].ssize;
+        }
+        else
+        {
+            marker.ssize=-1;
+            marker.Rvec.setTo ( cv::Scalar::all ( -999999 ) );
+            marker.Tvec.setTo ( cv::Scalar::all ( -999999 ) );
+        }
+    }
+}
+
+
+/************************************
+ *
+ * Corners of a candidate, in place
+ *
+ *
+ ************************************/
+void MarkerDetector::refineCorners ( MarkerCandidate &candidate,int level )
+{
+    ARUCO_SCOPED_TIMER ( "MarkerDetector::refineCorners" );
+    vector<cv::Point2f> &corners=candidate;
+    if ( level>0 )
+    {
+        int winSize=std::max ( 5,2<<level );
+        cornerSubPix ( grey, corners,cvSize ( winSize,winSize ), cvSize ( -1,-1 )   ,cvTermCriteria ( CV_TERMCRIT_ITER|CV_TERMCRIT_EPS,10,0.05 ) );
+    }
+    else if ( _cornerMethod==HARRIS )
+        findBestCornerInRegion_harris ( grey, corners,7 );
+    else if ( _cornerMethod==SUBPIX )
+        cornerSubPix ( grey, corners,cvSize ( 5,5 ), cvSize ( -1,-1 )   ,cvTermCriteria ( CV_TERMCRIT_ITER|CV_TERMCRIT_EPS,3,0.05 ) );
+}
+
+
+/************************************
+ *
+ * Warps and decodes every candidate on grey. Leaves the valid ones in _found and the rest in _rejected
+ *
+ *
+ ************************************/
+void MarkerDetector::identifyCandidates ( const cv::Mat &camMatrix,const cv::Mat &distCoeff )
+{
+    ARUCO_SCOPED_TIMER ( "MarkerDetector::identify" );
+    ThreadPool &pool=ThreadPool::global();
+    if ( _threadWorkspace.size() <size_t ( pool.size() ) ) _threadWorkspace.resize ( pool.size() );
+    for ( size_t t=0;t<_threadWorkspace.size();t++ ) {
+        _threadWorkspace[t].found.clear();
+        _threadWorkspace[t].rejected.clear();
+        for ( int r=0;r<N_CANDIDATE_REJECTIONS;r++ ) _threadWorkspace[t].rejections[r]=0;
+    }
+    pool.parallelFor ( 0,int ( _nMarkerCandidates ),[&] ( int i,int slot )
+    {
+        //one span per candidate, so a trace shows how the candidates were spread over the threads
+        ARUCO_SCOPED_TIMER ( "MarkerDetector::decodeCandidate" );
+        ThreadWorkspace &ws=_threadWorkspace[slot];
+        MarkerCandidate &candidate=_markerCandidates[i];
+        //most candidates of a cluttered frame are discarded here, before the expensive part
+        CandidateRejection rejection=rejectEarly ( candidate );
+        if ( rejection!=N_CANDIDATE_REJECTIONS )
+        {
+            ws.rejections[rejection]++;
+            pushBack ( ws.rejected,i,ws.growths );
+            return;
+        }
+        int nRotations;
+        unsigned int decodedFrame=_cacheFrame;
+        //a marker of a recent frame that did not move is not decoded again
+        int id=findKnownMarker ( candidate,nRotations,decodedFrame );
+        if ( id==-1 )
+        {
+            //the default markers can be read from the image, with no warp
+            if ( _cellSampling && markerIdDetector_ptrfunc==&FiducidalMarkers::detect )
+                id=FiducidalMarkers::detectInImage ( grey,candidate,nRotations );
+            //Find proyective homography
+            else if ( warp ( grey,ws.canonicalMarker,Size ( _markerWarpSize,_markerWarpSize ),candidate ) )
+                id= ( *markerIdDetector_ptrfunc ) ( ws.canonicalMarker,nRotations );
+        }
+        if ( id!=-1 )
+        {
+            if(_cornerMethod==LINES) // make LINES refinement before lose contour points
+                refineCandidateLines( candidate, camMatrix, distCoeff, ws );
+            //sort the points so that they are always in the same order no matter the camera orientation
+            std::rotate ( candidate.begin(),candidate.begin() +4-nRotations,candidate.end() );
+            FoundMarker found;
+            found.candidate=i;
+            found.id=id;
+            found.decodedFrame=decodedFrame;
+            pushBack ( ws.found,found,ws.growths );
+        }
+        else
+        {
+            ws.rejections[REJECT_DECODE]++;
+            pushBack ( ws.rejected,i,ws.growths );
+        }
+    } );
+    //unify parallel data. The candidates a thread got depend on the timing, so they are sorted
+    //back, and the results do not change from one run to another
+    _found.clear();
+    _rejected.clear();
+    for ( size_t t=0;t<_threadWorkspace.size();t++ ) {
+        for ( size_t j=0;j<_threadWorkspace[t].found.size();j++ ) pushBack ( _found,_threadWorkspace[t].found[j],_workspaceGrowths );
+        for ( size_t j=0;j<_threadWorkspace[t].rejected.size();j++ ) pushBack ( _rejected,_threadWorkspace[t].rejected[j],_workspaceGrowths );
+        for ( int r=0;r<N_CANDIDATE_REJECTIONS;r++ ) _rejections[r]+=_threadWorkspace[t].rejections[r];
+    }
+    std::sort ( _found.begin(),_found.end(),FoundMarkerIdLess() );
+    std::sort ( _rejected.begin(),_rejected.end() );
+}
+
+
+/************************************
+ *
+ * Cheap tests of a candidate, from the cheapest
+ *
+ *
+ ************************************/
+//a cell of a 7x7 marker needs at least 2x2 pixels to be read
+static const float MIN_CANDIDATE_AREA=14*14;
+//shortest side over the longest, about a marker seen 80 degrees away from the camera
+static const float MIN_SIDE_RATIO=0.2;
+//of the area of the quad, a larger difference is a contour with a different shape
+static const float MAX_AREA_MISMATCH=0.2;
+
+//point (u,v) of the quad, with the corners at (0,0),(1,0),(1,1) and (0,1). Bilinear, close enough to
+//the perspective within the marker
+static cv::Point2f quadPoint ( const vector<cv::Point2f> &quad,float u,float v )
+{
+    return quad[0]* ( ( 1-u ) * ( 1-v ) ) +quad[1]* ( u* ( 1-v ) ) +quad[2]* ( u*v ) +quad[3]* ( ( 1-u ) *v );
+}
+
+MarkerDetector::CandidateRejection MarkerDetector::rejectEarly ( const MarkerCandidate &candidate ) const
+{
+    //the same border the detected markers are checked against
+    float borderX=_borderDistThres*float ( grey.cols ),borderY=_borderDistThres*float ( grey.rows );
+    for ( int c=0;c<4;c++ )
+        if ( candidate[c].x<borderX || candidate[c].y<borderY || candidate[c].x>grey.cols-borderX || candidate[c].y>grey.rows-borderY )
+            return REJECT_BORDER;
+
+    float quadArea=0,minSide=1e10,maxSide=0;
+    for ( int c=0;c<4;c++ )
+    {
+        const cv::Point2f &a=candidate[c],&b=candidate[ ( c+1 ) %4];
+        quadArea+=a.x*b.y-b.x*a.y;
+        float side=cv::norm ( b-a );
+        minSide=std::min ( minSide,side );
+        maxSide=std::max ( maxSide,side );
+    }
+    quadArea=std::fabs ( quadArea ) /2;
+    if ( quadArea<MIN_CANDIDATE_AREA ) return REJECT_AREA;
+    if ( minSide<MIN_SIDE_RATIO*maxSide ) return REJECT_ASPECT;
+
+    if ( std::fabs ( cv::contourArea ( candidate.contour ) -quadArea ) >MAX_AREA_MISMATCH*quadArea ) return REJECT_CONTOUR;
+
+    //the middle of cells 1, 3 and 5 of each side of the border, and half a cell out of the quad beside them
+    if ( _minBorderContrast>0 )
+    {
+        int inside=0,outside=0,n=0;
+        for ( int s=0;s<4;s++ )
+            for ( int k=1;k<=5;k+=2 )
+            {
+                float along= ( k+0.5f ) /7,in=0.5f/7,out=-0.5f/7;
+                cv::Point2f pIn,pOut;
+                switch ( s ) {
+                case 0: pIn=quadPoint ( candidate,along,in );pOut=quadPoint ( candidate,along,out );break;
+                case 1: pIn=quadPoint ( candidate,1-in,along );pOut=quadPoint ( candidate,1-out,along );break;
+                case 2: pIn=quadPoint ( candidate,along,1-in );pOut=quadPoint ( candidate,along,1-out );break;
+                default: pIn=quadPoint ( candidate,in,along );pOut=quadPoint ( candidate,out,along );break;
+                }
+                int xIn=cvRound ( pIn.x ),yIn=cvRound ( pIn.y ),xOut=cvRound ( pOut.x ),yOut=cvRound ( pOut.y );
+                if ( xOut<0 || yOut<0 || xOut>=grey.cols || yOut>=grey.rows ||
+                     xIn<0 || yIn<0 || xIn>=grey.cols || yIn>=grey.rows ) continue;
+                inside+=grey.at<uchar> ( yIn,xIn );
+                outside+=grey.at<uchar> ( yOut,xOut );
+                n++;
+            }
+        if ( n>0 && outside-inside<_minBorderContrast*n ) return REJECT_CONTRAST;
+    }
+    return N_CANDIDATE_REJECTIONS;
+}
+
 
-    ///detect the position of detected markers if desired
-    if ( camMatrix.rows!=0  && markerSizeMeters>0 )
+/************************************
+ *
+ * Known marker with the same corners, in any rotation
+ *
+ *
+ ************************************/
+int MarkerDetector::findKnownMarker ( const MarkerCandidate &candidate,int &nRotations,unsigned int &decodedFrame ) const
+{
+    float maxDist2=_identityCacheMaxMove*_identityCacheMaxMove;
+    cv::Point2f offset ( _greyOffset );
+    for ( size_t k=0;k<_knownMarkers.size();k++ )
     {
-        for ( unsigned int i=0;i<detectedMarkers.size();i++ )
-            detectedMarkers[i].calculateExtrinsics ( markerSizeMeters,camMatrix,distCoeff,setYPerpendicular );
+        const KnownMarker &known=_knownMarkers[k];
+        if ( _cacheFrame-known.decodedFrame>=_identityCacheFrames ) continue;
+        //corner c of the known marker is corner (c+r)%4 of the candidate
+        for ( int r=0;r<4;r++ )
+        {
+            bool near=true;
+            for ( int c=0;c<4 && near;c++ )
+            {
+                cv::Point2f d=candidate[ ( c+r ) %4]+offset-known.corners[c];
+                near=d.dot ( d ) <=maxDist2;
+            }
+            if ( near )
+            {
+                //identifyCandidates rotates the candidate left by 4-nRotations, which puts corner r first
+                nRotations= ( 4-r ) %4;
+                decodedFrame=known.decodedFrame;
+                return known.id;
+            }
+        }
     }
+    return -1;
 }
 
 
@@ -281,96 +665,112 @@ void MarkerDetector::detect ( const  cv::Mat &input,vector<Marker> &detectedMark
  ************************************/
 void  MarkerDetector::detectRectangles ( const cv::Mat &thres,vector<std::vector<cv::Point2f> > &MarkerCanditates )
 {
-    vector<MarkerCandidate>  candidates;
-    detectRectangles(thres,candidates);
+    findCandidates(thres);
     //create the output
-    MarkerCanditates.resize(candidates.size());
+    MarkerCanditates.resize(_nMarkerCandidates);
     for (size_t i=0;i<MarkerCanditates.size();i++)
-        MarkerCanditates[i]=candidates[i];
+        MarkerCanditates[i]=_markerCandidates[i];
 }
 
-void MarkerDetector::detectRectangles(const cv::Mat &thresImg,vector<MarkerCandidate> & OutMarkerCanditates)
+void MarkerDetector::findCandidates(const cv::Mat &thresImg)
 {
-    vector<MarkerCandidate>  MarkerCanditates;
+    ARUCO_SCOPED_TIMER ( "MarkerDetector::detectRectangles" );
+    _nRectangles=0;
+    _nMarkerCandidates=0;
     //calcualte the min_max contour sizes
     int minSize=_minSize*std::max(thresImg.cols,thresImg.rows)*4;
     int maxSize=_maxSize*std::max(thresImg.cols,thresImg.rows)*4;
-    std::vector<std::vector<cv::Point> > contours2;
-    std::vector<cv::Vec4i> hierarchy2;
 
-    thresImg.copyTo ( thres2 );
-    cv::findContours ( thres2 , contours2, hierarchy2,CV_RETR_LIST, CV_CHAIN_APPROX_NONE );
-    vector<Point>  approxCurve;
+    traceContours ( thresImg,maxSize );
     ///for each contour, analyze if it is a paralelepiped likely to be the marker
-
-    for ( unsigned int i=0;i<contours2.size();i++ )
+    //the contours are split in one run of consecutive contours per workspace, and each run keeps its
+    //rectangles apart. Joining them in the order of the runs keeps the contour order
+    ThreadPool &pool=ThreadPool::global();
+    if ( _threadWorkspace.size() <size_t ( pool.size() ) ) _threadWorkspace.resize ( pool.size() );
+    for ( size_t t=0;t<_threadWorkspace.size();t++ ) _threadWorkspace[t].nRectangles=0;
+    int nRuns=int ( _threadWorkspace.size() ),nContours=int ( contours2.size() );
+    pool.parallelFor ( 0,nRuns,[&] ( int run,int )
     {
-
-
-        //check it is a possible element by first checking is has enough points
-        if ( minSize< contours2[i].size() &&contours2[i].size()<maxSize  )
+        ThreadWorkspace &ws=_threadWorkspace[run];
+        for ( int i=nContours*run/nRuns;i<nContours* ( run+1 ) /nRuns;i++ )
         {
-            //approximate to a poligon
-            approxPolyDP (  contours2[i]  ,approxCurve , double ( contours2[i].size() ) *0.05 , true );
-            // 				drawApproxCurve(copy,approxCurve,Scalar(0,0,255));
-            //check that the poligon has 4 points
-            if ( approxCurve.size() ==4 )
+            vector<cv::Point> &approxCurve=ws.approxCurve;
+
+            //check it is a possible element by first checking is has enough points
+            if ( minSize< contours2[i].size() &&contours2[i].size()<maxSize  )
             {
+                //approximate to a poligon
+                approxPolyDP (  contours2[i]  ,approxCurve , double ( contours2[i].size() ) *0.05 , true );
+                // 				drawApproxCurve(copy,approxCurve,Scalar(0,0,255));
+                //check that the poligon has 4 points
+                if ( approxCurve.size() ==4 )
+                {
 
 //  	   drawContour(input,contours2[i],Scalar(255,0,225));
 //  		  namedWindow("input");
 //  		imshow("input",input);
 //  	 	waitKey(0);
-                //and is convex
-                if ( isContourConvex ( Mat ( approxCurve ) ) )
-                {
+                    //and is convex
+                    if ( isContourConvex ( approxCurve ) )
+                    {
 // 					      drawApproxCurve(input,approxCurve,Scalar(255,0,255));
 // 						//ensure that the   distace between consecutive points is large enough
-                    float minDist=1e10;
-                    for ( int j=0;j<4;j++ )
-                    {
-                        float d= std::sqrt ( ( float ) ( approxCurve[j].x-approxCurve[ ( j+1 ) %4].x ) * ( approxCurve[j].x-approxCurve[ ( j+1 ) %4].x ) +
-                                             ( approxCurve[j].y-approxCurve[ ( j+1 ) %4].y ) * ( approxCurve[j].y-approxCurve[ ( j+1 ) %4].y ) );
-                        // 		norm(Mat(approxCurve[i]),Mat(approxCurve[(i+1)%4]));
-                        if ( d<minDist ) minDist=d;
-                    }
-                    //check that distance is not very small
-                    if ( minDist>10 )
-                    {
-                        //add the points
-                        // 	      cout<<"ADDED"<<endl;
-                        MarkerCanditates.push_back ( MarkerCandidate() );
-                        MarkerCanditates.back().idx=i;
+                        float minDist=1e10;
                         for ( int j=0;j<4;j++ )
                         {
-                            MarkerCanditates.back().push_back ( Point2f ( approxCurve[j].x,approxCurve[j].y ) );
+                            float d= std::sqrt ( ( float ) ( approxCurve[j].x-approxCurve[ ( j+1 ) %4].x ) * ( approxCurve[j].x-approxCurve[ ( j+1 ) %4].x ) +
+                                                 ( approxCurve[j].y-approxCurve[ ( j+1 ) %4].y ) * ( approxCurve[j].y-approxCurve[ ( j+1 ) %4].y ) );
+                            // 		norm(Mat(approxCurve[i]),Mat(approxCurve[(i+1)%4]));
+                            if ( d<minDist ) minDist=d;
+                        }
+                        //check that distance is not very small
+                        if ( minDist>10 )
+                        {
+                            //add the points
+                            // 	      cout<<"ADDED"<<endl;
+                            MarkerCandidate &candidate=nextInPool ( ws.rectangles,ws.nRectangles,ws.growths );
+                            candidate.idx=i;
+                            candidate.resize ( 4 );
+                            for ( int j=0;j<4;j++ )
+                            {
+                                candidate[j]=Point2f ( approxCurve[j].x,approxCurve[j].y );
+                            }
                         }
                     }
                 }
             }
         }
-    }
+    } );
 
 // 		 		  namedWindow("input");
 //  		imshow("input",input);
 //  						waitKey(0);
+    //join
+    for ( size_t t=0;t<_threadWorkspace.size();t++ )
+        for ( size_t j=0;j<_threadWorkspace[t].nRectangles;j++ )
+        {
+            const MarkerCandidate &rectangle=_threadWorkspace[t].rectangles[j];
+            MarkerCandidate &candidate=nextInPool ( _rectangles,_nRectangles );
+            static_cast<vector<cv::Point2f> &> ( candidate ) =rectangle;
+            candidate.idx=rectangle.idx;
+        }
     ///sort the points in anti-clockwise order
-    valarray<bool> swapped(false,MarkerCanditates.size());//used later
-    for ( unsigned int i=0;i<MarkerCanditates.size();i++ )
+    assignWorkspace ( _swapped,_nRectangles,char ( false ) );//used later
+    for ( unsigned int i=0;i<_nRectangles;i++ )
     {
 
         //trace a line between the first and second point.
         //if the thrid point is at the right side, then the points are anti-clockwise
-        double dx1 = MarkerCanditates[i][1].x - MarkerCanditates[i][0].x;
-        double dy1 =  MarkerCanditates[i][1].y - MarkerCanditates[i][0].y;
-        double dx2 = MarkerCanditates[i][2].x - MarkerCanditates[i][0].x;
-        double dy2 = MarkerCanditates[i][2].y - MarkerCanditates[i][0].y;
+        double dx1 = _rectangles[i][1].x - _rectangles[i][0].x;
+        double dy1 =  _rectangles[i][1].y - _rectangles[i][0].y;
+        double dx2 = _rectangles[i][2].x - _rectangles[i][0].x;
+        double dy2 = _rectangles[i][2].y - _rectangles[i][0].y;
         double o = ( dx1*dy2 )- ( dy1*dx2 );
 
         if ( o  < 0.0 )		 //if the third point is in the left side, then sort in anti-clockwise order
         {
-            swap ( MarkerCanditates[i][1],MarkerCanditates[i][3] );
-            swapped[i]=true;
+            swap ( _rectangles[i][1],_rectangles[i][3] );
+            _swapped[i]=true;
             //sort the contour points
 //  	    reverse(MarkerCanditates[i].contour.begin(),MarkerCanditates[i].contour.end());//????
 
@@ -379,53 +779,238 @@ void MarkerDetector::detectRectangles(const cv::Mat &thresImg,vector<MarkerCandi
       
     /// remove these elements which corners are too close to each other
     //first detect candidates to be removed
- 
-    vector< vector<pair<int,int>  > > TooNearCandidates_omp(omp_get_max_threads());
-    #pragma omp parallel for
-    for ( unsigned int i=0;i<MarkerCanditates.size();i++ )
+    //If the average distance of the corners is under the limit, so is the distance of the centers.
+    //The centers go to a grid with cells of that size, and each candidate is only compared
+    //with the ones in its cell and the eight around it
+    const int tooNearDist=10;
+    int gridCols=thresImg.cols/tooNearDist+1,gridRows=thresImg.rows/tooNearDist+1;
+    assignWorkspace ( _gridCell,_nRectangles,0 );
+    assignWorkspace ( _gridStart,size_t ( gridCols*gridRows+1 ),0 );
+    for ( unsigned int i=0;i<_nRectangles;i++ )
     {
-        // 	cout<<"Marker i="<<i<<MarkerCanditates[i]<<endl;
-        //calculate the average distance of each corner to the nearest corner of the other marker candidate
-        for ( unsigned int j=i+1;j<MarkerCanditates.size();j++ )
-        {
-            float dist=0;
-            for ( int c=0;c<4;c++ )
-                dist+= sqrt ( ( MarkerCanditates[i][c].x-MarkerCanditates[j][c].x ) * ( MarkerCanditates[i][c].x-MarkerCanditates[j][c].x ) + ( MarkerCanditates[i][c].y-MarkerCanditates[j][c].y ) * ( MarkerCanditates[i][c].y-MarkerCanditates[j][c].y ) );
-            dist/=4;
-            //if distance is too small
-            if ( dist< 10 )
-            {
-                TooNearCandidates_omp[omp_get_thread_num()].push_back ( pair<int,int> ( i,j ) );
-            }
-        }
+        cv::Point2f center= ( _rectangles[i][0]+_rectangles[i][1]+_rectangles[i][2]+_rectangles[i][3] ) *0.25f;
+        int col=std::min ( std::max ( int ( center.x/tooNearDist ),0 ),gridCols-1 );
+        int row=std::min ( std::max ( int ( center.y/tooNearDist ),0 ),gridRows-1 );
+        _gridCell[i]=row*gridCols+col;
+        _gridStart[_gridCell[i]+1]++;
     }
+    for ( size_t c=1;c<_gridStart.size();c++ ) _gridStart[c]+=_gridStart[c-1];
+    //the candidates of each cell, in increasing order
+    assignWorkspace ( _gridMembers,_nRectangles,0 );
+    assignWorkspace ( _gridFill,_gridStart.size(),0 );
+    std::copy ( _gridStart.begin(),_gridStart.end(),_gridFill.begin() );
+    for ( unsigned int i=0;i<_nRectangles;i++ ) _gridMembers[_gridFill[_gridCell[i]]++]=i;
+
+    for ( size_t t=0;t<_threadWorkspace.size();t++ ) _threadWorkspace[t].tooNear.clear();
+    pool.parallelFor ( 0,int ( _nRectangles ),[&] ( int i,int slot )
+    {
+        ThreadWorkspace &ws=_threadWorkspace[slot];
+        int col=_gridCell[i]%gridCols,row=_gridCell[i]/gridCols;
+        for ( int r=std::max ( row-1,0 );r<=std::min ( row+1,gridRows-1 );r++ )
+            for ( int c=std::max ( col-1,0 );c<=std::min ( col+1,gridCols-1 );c++ )
+                for ( int m=_gridStart[r*gridCols+c];m<_gridStart[r*gridCols+c+1];m++ )
+                {
+                    //each pair once, from its first candidate
+                    int j=_gridMembers[m];
+                    if ( j<=i ) continue;
+                    // 	cout<<"Marker i="<<i<<MarkerCanditates[i]<<endl;
+                    //calculate the average distance of each corner to the nearest corner of the other marker candidate
+                    float dist=0;
+                    for ( int k=0;k<4;k++ )
+                        dist+= sqrt ( ( _rectangles[i][k].x-_rectangles[j][k].x ) * ( _rectangles[i][k].x-_rectangles[j][k].x ) + ( _rectangles[i][k].y-_rectangles[j][k].y ) * ( _rectangles[i][k].y-_rectangles[j][k].y ) );
+                    dist/=4;
+                    //if distance is too small
+                    if ( dist< tooNearDist )
+                    {
+                        pushBack ( ws.tooNear,pair<int,int> ( i,j ),ws.growths );
+                    }
+                }
+    },16 );
     //join
-     vector<pair<int,int>  > TooNearCandidates;
-     joinVectors(  TooNearCandidates_omp,TooNearCandidates);
+    _tooNear.clear();
+    for ( size_t t=0;t<_threadWorkspace.size();t++ )
+        for ( size_t j=0;j<_threadWorkspace[t].tooNear.size();j++ ) pushBack ( _tooNear,_threadWorkspace[t].tooNear[j],_workspaceGrowths );
     //mark for removal the element of  the pair with smaller perimeter
-    valarray<bool> toRemove ( false,MarkerCanditates.size() );
-    for ( unsigned int i=0;i<TooNearCandidates.size();i++ )
+    assignWorkspace ( _tooNearRemove,_nRectangles,char ( false ) );
+    for ( unsigned int i=0;i<_tooNear.size();i++ )
     {
-        if ( perimeter ( MarkerCanditates[TooNearCandidates[i].first ] ) >perimeter ( MarkerCanditates[ TooNearCandidates[i].second] ) )
-            toRemove[TooNearCandidates[i].second]=true;
-        else toRemove[TooNearCandidates[i].first]=true;
+        if ( perimeter ( _rectangles[_tooNear[i].first ] ) >perimeter ( _rectangles[ _tooNear[i].second] ) )
+            _tooNearRemove[_tooNear[i].second]=true;
+        else _tooNearRemove[_tooNear[i].first]=true;
     }
 
-    //remove the invalid ones
-//     removeElements ( MarkerCanditates,toRemove );
     //finally, assign to the remaining candidates the contour
-    OutMarkerCanditates.reserve(MarkerCanditates.size());
-    for (size_t i=0;i<MarkerCanditates.size();i++) {
-        if (!toRemove[i]) {
-            OutMarkerCanditates.push_back(MarkerCanditates[i]);
-            OutMarkerCanditates.back().contour=contours2[ MarkerCanditates[i].idx];
-            if (swapped[i] )//if the corners where swapped, it is required to reverse here the points so that they are in the same order
-                reverse(OutMarkerCanditates.back().contour.begin(),OutMarkerCanditates.back().contour.end());//????
+    for (size_t i=0;i<_nRectangles;i++) {
+        if (!_tooNearRemove[i]) {
+            MarkerCandidate &candidate=nextInPool ( _markerCandidates,_nMarkerCandidates );
+            const vector<cv::Point> &contour=contours2[ _rectangles[i].idx];
+            if ( contour.size() >candidate.contour.capacity() ) _workspaceGrowths++;
+            static_cast<vector<cv::Point2f> &> ( candidate ) =_rectangles[i];
+            candidate.idx=_rectangles[i].idx;
+            candidate.contour.assign ( contour.begin(),contour.end() );
+            if (_swapped[i] )//if the corners where swapped, it is required to reverse here the points so that they are in the same order
+                reverse(candidate.contour.begin(),candidate.contour.end());//????
         }
     }
 
 }
 
+/************************************
+ *
+ * Contours of the thresholded image, traced in stripes
+ *
+ *
+ ************************************/
+//fewer rows than this per stripe are not worth a thread
+static const int MIN_STRIPE_ROWS=48;
+//of the image, seam regions larger than this are not traced again, the image is traced whole
+static const float MAX_SEAM_AREA=0.25;
+//frames traced whole after one with too much in the seams, before the stripes are tried again
+static const unsigned int SERIAL_CONTOUR_FRAMES=8;
+
+//findContours clears the outer pixels of the image it gets, so a contour within two pixels
+//of a side of the region may be cut, unless that side is the border of the whole image
+static bool isCutByRegion ( const cv::Rect &box,const cv::Rect &roi,const cv::Size &size )
+{
+    return ( roi.x>0 && box.x<roi.x+2 ) || ( roi.y>0 && box.y<roi.y+2 ) ||
+           ( roi.x+roi.width<size.width && box.x+box.width>roi.x+roi.width-2 ) ||
+           ( roi.y+roi.height<size.height && box.y+box.height>roi.y+roi.height-2 );
+}
+
+void MarkerDetector::ContourRegion::trace ( const cv::Mat &thresImg )
+{
+    thresImg ( roi ).copyTo ( image );
+    cv::findContours ( image,contours,hierarchy,CV_RETR_LIST,CV_CHAIN_APPROX_NONE,roi.tl() );
+    kept.clear();
+    cut.clear();
+}
+
+void MarkerDetector::traceContours ( const cv::Mat &thresImg,size_t maxContourSize )
+{
+    ARUCO_SCOPED_TIMER ( "MarkerDetector::traceContours" );
+    ThreadPool &pool=ThreadPool::global();
+    int nStripes=std::min ( pool.size(),thresImg.rows/MIN_STRIPE_ROWS );
+    //after a frame whose seams took much of the image, the next ones are traced whole for a while
+    if ( _serialContourFrames>0 ) _serialContourFrames--;
+    else if ( nStripes>=2 && _parallelContours )
+    {
+        if ( traceContourStripes ( thresImg,nStripes,maxContourSize ) ) return;
+        _serialContourFrames=SERIAL_CONTOUR_FRAMES;
+    }
+
+    ARUCO_SCOPED_TIMER ( "MarkerDetector::traceContoursWhole" );
+    thresImg.copyTo ( thres2 );
+    cv::findContours ( thres2 , contours2, hierarchy2,CV_RETR_LIST, CV_CHAIN_APPROX_NONE );
+}
+
+bool MarkerDetector::traceContourStripes ( const cv::Mat &thresImg,int nStripes,size_t maxContourSize )
+{
+    ThreadPool &pool=ThreadPool::global();
+    cv::Rect image ( 0,0,thresImg.cols,thresImg.rows );
+
+    if ( _contourStripes.size() <size_t ( nStripes ) ) _contourStripes.resize ( nStripes );
+    assignWorkspace ( _stripeLimits,nStripes+1,0 );
+    for ( int k=0;k<=nStripes;k++ ) _stripeLimits[k]=thresImg.rows*k/nStripes;
+
+    //each stripe is traced with two more rows above and below. A contour is kept by the stripe
+    //that has all its rows, the rest are cut by a seam. A closed contour has at least two points per
+    //pixel of the largest side of its box, and a piece is in the box of its contour, so a piece that
+    //wide belongs to a contour too long to be a candidate: the table, a hand, a shadow. It is not
+    //traced again, it would make its seam region as large as the image
+    pool.parallelFor ( 0,nStripes,[&] ( int k,int )
+    {
+        ContourRegion &stripe=_contourStripes[k];
+        int top=std::max ( 0,_stripeLimits[k]-2 ),bottom=std::min ( thresImg.rows,_stripeLimits[k+1]+2 );
+        stripe.roi=cv::Rect ( 0,top,thresImg.cols,bottom-top );
+        stripe.trace ( thresImg );
+        for ( size_t i=0;i<stripe.contours.size();i++ )
+        {
+            cv::Rect box=cv::boundingRect ( stripe.contours[i] );
+            if ( box.y>=_stripeLimits[k] && box.y+box.height<=_stripeLimits[k+1] ) pushBack ( stripe.kept,int ( i ),stripe.growths );
+            else if ( 2*size_t ( std::max ( box.width,box.height )-1 ) <maxContourSize ) pushBack ( stripe.cut,box,stripe.growths );
+        }
+    } );
+
+    //the pieces of a contour cut by the seams overlap, so the regions that contain them whole
+    //are found merging the boxes of the pieces, with the two pixels findContours needs around them
+    _seamRegions.clear();
+    for ( int k=0;k<nStripes;k++ )
+        for ( size_t i=0;i<_contourStripes[k].cut.size();i++ )
+        {
+            const cv::Rect &box=_contourStripes[k].cut[i];
+            pushBack ( _seamRegions,cv::Rect ( box.x-2,box.y-2,box.width+4,box.height+4 ) &image,_workspaceGrowths );
+        }
+    bool merged=true;
+    while ( merged )
+    {
+        merged=false;
+        for ( size_t i=0;i<_seamRegions.size();i++ )
+            for ( size_t j=i+1;j<_seamRegions.size(); )
+            {
+                if ( ( _seamRegions[i]&_seamRegions[j] ).area() >0 )
+                {
+                    _seamRegions[i]|=_seamRegions[j];
+                    _seamRegions.erase ( _seamRegions.begin() +j );
+                    merged=true;
+                }
+                else j++;
+            }
+    }
+
+    //with most of the image in the seams, tracing them again would cost more than the whole image
+    int seamArea=0;
+    for ( size_t i=0;i<_seamRegions.size();i++ ) seamArea+=_seamRegions[i].area();
+    if ( seamArea>MAX_SEAM_AREA*image.area() ) return false;
+
+    //only the contours that cross a seam are taken from these regions, the others are in the stripes
+    if ( _contourSeams.size() <_seamRegions.size() ) _contourSeams.resize ( _seamRegions.size() );
+    pool.parallelFor ( 0,int ( _seamRegions.size() ),[&] ( int s,int )
+    {
+        ContourRegion &seam=_contourSeams[s];
+        seam.roi=_seamRegions[s];
+        seam.trace ( thresImg );
+        for ( size_t i=0;i<seam.contours.size();i++ )
+        {
+            cv::Rect box=cv::boundingRect ( seam.contours[i] );
+            if ( isCutByRegion ( box,seam.roi,image.size() ) ) continue;
+            int firstStripe=std::upper_bound ( _stripeLimits.begin(),_stripeLimits.end(),box.y )-_stripeLimits.begin();
+            int lastStripe=std::upper_bound ( _stripeLimits.begin(),_stripeLimits.end(),box.y+box.height-1 )-_stripeLimits.begin();
+            if ( firstStripe!=lastStripe ) pushBack ( seam.kept,int ( i ),seam.growths );
+        }
+    } );
+
+    //joined in a fixed order, stripes first, whatever thread traced them
+    size_t nContours=0;
+    for ( int k=0;k<nStripes;k++ ) nContours+=_contourStripes[k].kept.size();
+    for ( size_t s=0;s<_seamRegions.size();s++ ) nContours+=_contourSeams[s].kept.size();
+    if ( nContours>contours2.capacity() ) _workspaceGrowths++;
+    contours2.resize ( nContours );
+    size_t n=0;
+    for ( int k=0;k<nStripes;k++ )
+        for ( size_t i=0;i<_contourStripes[k].kept.size();i++ ) contours2[n++].swap ( _contourStripes[k].contours[_contourStripes[k].kept[i]] );
+    for ( size_t s=0;s<_seamRegions.size();s++ )
+        for ( size_t i=0;i<_contourSeams[s].kept.size();i++ ) contours2[n++].swap ( _contourSeams[s].contours[_contourSeams[s].kept[i]] );
+    return true;
+}
+
+/************************************
+ *
+ * Candidates with no valid id found by the last call to detect
+ *
+ *
+ ************************************/
+const vector<std::vector<cv::Point2f> > &MarkerDetector::getCandidates()
+{
+    //built here, detect() only keeps their indices
+    if ( _candidates.size() !=_rejected.size() )
+    {
+        _candidates.resize ( _rejected.size() );
+        for ( size_t i=0;i<_rejected.size();i++ )
+            _candidates[i]=_markerCandidates[_rejected[i]];
+    }
+    return _candidates;
+}
+
 /************************************
  *
  *
@@ -434,6 +1019,7 @@ void MarkerDetector::detectRectangles(const cv::Mat &thresImg,vector<MarkerCandi
  ************************************/
 void MarkerDetector::thresHold ( int method,const Mat &grey,Mat &out,double param1,double param2 ) throw ( cv::Exception )
 {
+    ARUCO_SCOPED_TIMER ( "MarkerDetector::thresHold" );
 
     if (param1==-1) param1=_thresParam1;
     if (param2==-1) param2=_thresParam2;
@@ -449,7 +1035,8 @@ void MarkerDetector::thresHold ( int method,const Mat &grey,Mat &out,double para
         if ( param1<3 ) param1=3;
         else if ( ( ( int ) param1 ) %2 !=1 ) param1= ( int ) ( param1+1 );
 
-        cv::adaptiveThreshold ( grey,out,255,ADAPTIVE_THRESH_MEAN_C,THRESH_BINARY_INV,param1,param2 );
+        //same output as cv::adaptiveThreshold ( MEAN_C,THRESH_BINARY_INV ), with running sums and in parallel
+        adaptiveThresholdMean ( grey,out,param1,param2,255 );
         break;
     case CANNY:
     {
@@ -473,7 +1060,7 @@ void MarkerDetector::thresHold ( int method,const Mat &grey,Mat &out,double para
  *
  *
  ************************************/
-bool MarkerDetector::warp ( Mat &in,Mat &out,Size size, vector<Point2f> points ) throw ( cv::Exception )
+bool MarkerDetector::warp ( Mat &in,Mat &out,Size size, const vector<Point2f> &points ) throw ( cv::Exception )
 {
 
     if ( points.size() !=4 )    throw cv::Exception ( 9001,"point.size()!=4","MarkerDetector::warp",__FILE__,__LINE__ );
@@ -762,10 +1349,15 @@ void MarkerDetector::findBestCornerInRegion_harris ( const cv::Mat  & grey,vecto
  *
  */
 void MarkerDetector::refineCandidateLines(MarkerDetector::MarkerCandidate& candidate, const cv::Mat &camMatrix, const cv::Mat &distCoeff)
+{
+      ThreadWorkspace ws;
+      refineCandidateLines(candidate, camMatrix, distCoeff, ws);
+}
+
+void MarkerDetector::refineCandidateLines(MarkerDetector::MarkerCandidate& candidate, const cv::Mat &camMatrix, const cv::Mat &distCoeff, ThreadWorkspace &ws)
 {
       // search corners on the contour vector
-      vector<unsigned int> cornerIndex;
-      cornerIndex.resize(4);
+      unsigned int cornerIndex[4]={0,0,0,0};
       for(unsigned int j=0; j<candidate.contour.size(); j++) {
 	for(unsigned int k=0; k<4; k++) {
 	  if(candidate.contour[j].x==candidate[k].x && candidate.contour[j].y==candidate[k].y) {
@@ -787,40 +1379,43 @@ void MarkerDetector::refineCandidateLines(MarkerDetector::MarkerCandidate& candi
       int inc = 1;
       if(inverse) inc = -1;
       
-      // undistort contour
-      vector<Point2f> contour2f;
+      // undistort contour. The buffers are the ones of the thread, kept between calls
+      vector<Point2f> &contour2f=ws.contour2f;
+      if (candidate.contour.size()>contour2f.capacity()) ws.growths++;
+      contour2f.resize(candidate.contour.size());
       for(unsigned int i=0; i<candidate.contour.size(); i++) 
-	contour2f.push_back( cv::Point2f(candidate.contour[i].x, candidate.contour[i].y) );      
+	contour2f[i] = cv::Point2f(candidate.contour[i].x, candidate.contour[i].y);
       if(!camMatrix.empty() && !distCoeff.empty())
 	cv::undistortPoints(contour2f, contour2f, camMatrix, distCoeff, cv::Mat(), camMatrix); 
 
 
-      vector<std::vector<cv::Point2f> > contourLines;
-      contourLines.resize(4);
+      vector<cv::Point2f> *contourLines=ws.contourLines;
       for(unsigned int l=0; l<4; l++) {
+	contourLines[l].clear();
 	for(int j=(int)cornerIndex[l]; j!=(int)cornerIndex[(l+1)%4]; j+=inc) {
 	  if(j==(int)candidate.contour.size() && !inverse) j=0;
 	  else if(j==0 && inverse) j=candidate.contour.size()-1;
-	  contourLines[l].push_back(contour2f[j]);
+	  pushBack(contourLines[l], contour2f[j], ws.growths);
 	  if(j==(int)cornerIndex[(l+1)%4]) break; // this has to be added because of the previous ifs
 	}
 	
       }
 
       // interpolate marker lines
-      vector<Point3f> lines;
-      lines.resize(4);
-      for(unsigned int j=0; j<lines.size(); j++) interpolate2Dline(contourLines[j], lines[j]);    
+      Point3f lines[4];
+      for(unsigned int j=0; j<4; j++) interpolate2Dline(contourLines[j], lines[j]);    
       
       // get cross points of lines
-      vector<Point2f> crossPoints;
-      crossPoints.resize(4);
+      Point2f crossPoints[4];
       for(unsigned int i=0; i<4; i++)
-	crossPoints[i] = getCrossPoint( lines[(i-1)%4], lines[i] );
+	crossPoints[i] = getCrossPoint( lines[(i+3)%4], lines[i] );
       
       // distort corners again if undistortion was performed
-      if(!camMatrix.empty() && !distCoeff.empty())
-	  distortPoints(crossPoints, crossPoints, camMatrix, distCoeff);
+      if(!camMatrix.empty() && !distCoeff.empty()) {
+	  vector<Point2f> distorted(crossPoints, crossPoints+4);
+	  distortPoints(distorted, distorted, camMatrix, distCoeff);
+	  std::copy(distorted.begin(), distorted.end(), crossPoints);
+      }
       
       // reassing points
       for(unsigned int j=0; j<4; j++)
@@ -829,6 +1424,8 @@ void MarkerDetector::refineCandidateLines(MarkerDetector::MarkerCandidate& candi
 
 
 /**
+ * Least squares line, with the normal equations of the 2x2 system instead of a decomposition of the
+ * whole matrix. Only a degenerate set of points goes through solve()
  */
 void MarkerDetector::interpolate2Dline( const std::vector< Point2f >& inPoints, Point3f& outLine)
 {
@@ -843,43 +1440,39 @@ void MarkerDetector::interpolate2Dline( const std::vector< Point2f >& inPoints,
     if(inPoints[i].y > maxY) maxY = inPoints[i].y;
   }
 
-    // create matrices of equation system
-    Mat A(inPoints.size(),2,CV_32FC1, Scalar(0));
-    Mat B(inPoints.size(),1,CV_32FC1, Scalar(0));
-    Mat X;
-
-    
-    
-    if( maxX-minX > maxY-minY ) {
-      // Ax + C = y
-      for (int i=0; i<inPoints.size(); i++) {
-
-	  A.at<float>(i, 0) = inPoints[i].x;
-	  A.at<float>(i, 1) = 1.;
-	  B.at<float>(i, 0) = inPoints[i].y;
-
-      }
-
-      // solve system
-      solve(A,B,X, DECOMP_SVD);
-      // return Ax + By + C
-      outLine = Point3f(X.at<float>(0,0), -1., X.at<float>(1,0));  
+    // Ax + C = y, or By + C = x for a line closer to vertical
+    bool alongX = maxX-minX > maxY-minY;
+    double n=inPoints.size(), sumU=0, sumV=0, sumUU=0, sumUV=0;
+    for (size_t i=0; i<inPoints.size(); i++) {
+      double u = alongX ? inPoints[i].x : inPoints[i].y;
+      double v = alongX ? inPoints[i].y : inPoints[i].x;
+      sumU+=u; sumV+=v; sumUU+=u*u; sumUV+=u*v;
+    }
+    double det = n*sumUU-sumU*sumU;
+    float slope, offset;
+    if (std::fabs(det) > 1e-9*std::max(1.,n*sumUU)) {
+      slope = float((n*sumUV-sumU*sumV)/det);
+      offset = float((sumUU*sumV-sumU*sumUV)/det);
     }
     else {
-      // By + C = x
-      for (int i=0; i<inPoints.size(); i++) {
-
-	  A.at<float>(i, 0) = inPoints[i].y;
+      // create matrices of equation system
+      Mat A(inPoints.size(),2,CV_32FC1, Scalar(0));
+      Mat B(inPoints.size(),1,CV_32FC1, Scalar(0));
+      Mat X;
+      for (size_t i=0; i<inPoints.size(); i++) {
+	  A.at<float>(i, 0) = alongX ? inPoints[i].x : inPoints[i].y;
 	  A.at<float>(i, 1) = 1.;
-	  B.at<float>(i, 0) = inPoints[i].x;
-
+	  B.at<float>(i, 0) = alongX ? inPoints[i].y : inPoints[i].x;
       }
-
       // solve system
       solve(A,B,X, DECOMP_SVD);
-      // return Ax + By + C
-      outLine = Point3f(-1., X.at<float>(0,0), X.at<float>(1,0));        
+      slope = X.at<float>(0,0);
+      offset = X.at<float>(1,0);
     }
+
+    // return Ax + By + C
+    if( alongX ) outLine = Point3f(slope, -1., offset);  
+    else outLine = Point3f(-1., slope, offset);        
   
 }
 
@@ -888,6 +1481,13 @@ void MarkerDetector::interpolate2Dline( const std::vector< Point2f >& inPoints,
 Point2f MarkerDetector::getCrossPoint(const cv::Point3f& line1, const cv::Point3f& line2)
 {
   
+    // Cramer's rule, and solve() only for lines that are nearly parallel
+    double det = double(line1.x)*line2.y-double(line1.y)*line2.x;
+    double scale = std::max(std::fabs(double(line1.x))+std::fabs(double(line1.y)), std::fabs(double(line2.x))+std::fabs(double(line2.y)));
+    if (std::fabs(det) > 1e-9*scale*scale)
+      return Point2f(float((-double(line1.z)*line2.y+double(line2.z)*line1.y)/det),
+                     float((-double(line2.z)*line1.x+double(line1.z)*line2.x)/det));
+
     // create matrices of equation system
     Mat A(2,2,CV_32FC1, Scalar(0));
     Mat B(2,1,CV_32FC1, Scalar(0));
@@ -33,6 +33,7 @@ or implied, of Rafael Muñoz Salinas.
 #include "cameraparameters.h"
 #include "exports.h"
 #include "marker.h"
+#include "ar_threadpool.h"
 using namespace std;
 
 namespace aruco
@@ -113,6 +114,51 @@ public:
                 float markerSizeMeters=-1,
                 bool setYPerperdicular=false) throw (cv::Exception);
 
+    /**Detects the markers in an image the caller already converted to grey and thresholded,
+     * so the conversion, the image reduction and thresHold() are skipped. getThresholdedImage() is
+     * only updated if erosion is enabled
+     *
+     * @param greyImg grey image, used to identify the markers and refine the corners
+     * @param thresImg binary image of the size of greyImg, not zero where the image is dark, like the
+     * output of thresHold()
+     * @param detectedMarkers output vector with the markers detected
+     * @param camMatrix intrinsic camera information.
+     * @param distCoeff camera distorsion coefficient. If set Mat() if is assumed no camera distorion
+     * @param markerSizeMeters size of the marker sides expressed in meters
+     * @param setYPerperdicular If set the Y axis will be perpendicular to the surface. Otherwise, it
+     * will be the Z axis
+     */
+    void detectThresholded(const cv::Mat &greyImg,
+                           const cv::Mat &thresImg,
+                           std::vector<Marker> &detectedMarkers,
+                           cv::Mat camMatrix=cv::Mat(),
+                           cv::Mat distCoeff=cv::Mat(),
+                           float markerSizeMeters=-1,
+                           bool setYPerperdicular=false) throw (cv::Exception);
+
+    /**Same as above, with the camera parameters
+     */
+    void detectThresholded(const cv::Mat &greyImg,
+                           const cv::Mat &thresImg,
+                           std::vector<Marker> &detectedMarkers,
+                           CameraParameters camParams,
+                           float markerSizeMeters=-1,
+                           bool setYPerperdicular=false) throw (cv::Exception);
+
+    /**Same as above, with thresImg thresholded from the thresLevel-th pyrDown() of greyImg, so the contours
+     * are traced in the reduced image. Each side of thresImg is that of greyImg divided by 2^thresLevel, rounded
+     * up, as cv::pyrDown gives it. The markers are identified and their corners refined in greyImg.
+     * If greyImg is a region of a larger image, it must start at a multiple of 2^thresLevel.
+     * See nextPyrDownLevel() to choose thresLevel
+     */
+    void detectThresholded(const cv::Mat &greyImg,
+                           const cv::Mat &thresImg,
+                           unsigned int thresLevel,
+                           std::vector<Marker> &detectedMarkers,
+                           CameraParameters camParams,
+                           float markerSizeMeters=-1,
+                           bool setYPerperdicular=false) throw (cv::Exception);
+
     /**This set the type of thresholding methods available
      */
     enum ThresholdMethods {FIXED_THRES,ADPT_THRES,CANNY};
@@ -196,6 +242,20 @@ public:
      */
     void enableErosion(bool enable){_doErosion=enable;}
 
+    /**Enables/Disables reading the cells of the candidates straight from the image, sampling a few points
+     * of each one, instead of warping every candidate to a canonical image first. Only the default marker
+     * detector function can do it, the others always get the warped image. By default, this property is enabled
+     */
+    void enableCellSampling(bool enable){_cellSampling=enable;}
+    bool isCellSamplingEnabled()const{return _cellSampling;}
+
+    /**Enables/Disables tracing the contours of the thresholded image in stripes in parallel. The stripes
+     * are skipped anyway for a few frames after one where the contours that cross them covered much of
+     * the image. By default, this property is enabled
+     */
+    void enableParallelContours(bool enable){_parallelContours=enable;}
+    bool isParallelContoursEnabled()const{return _parallelContours;}
+
     /**
      * Specifies a value to indicate the required speed for the internal processes. If you need maximum
      * speed (at the cost of a lower detection rate),
@@ -243,6 +303,7 @@ public:
      */
     void setMakerDetectorFunction(int (* markerdetector_func)(const cv::Mat &in,int &nRotations) )  {
         markerIdDetector_ptrfunc=markerdetector_func;
+        _knownMarkers.clear();
     }
 
     /** Use an smaller version of the input image for marker detection. 
@@ -254,6 +315,76 @@ public:
      */
     void pyrDown(unsigned int level)  {
         pyrdown_level=level;
+        _autoMinMarkerPixels=0;
+    }
+
+    /** Chooses the pyrDown() level of every detect(), and the one of nextPyrDownLevel(), from the markers found in the last frames, as high as
+     * possible while the sides of the smallest of them still have minMarkerPixels in the reduced image.
+     * A frame after one with no markers, and one every AUTO_PYRDOWN_FRAMES, is processed at full resolution
+     * so that new or smaller markers are not lost. The corners found in a reduced image are refined with
+     * cornerSubPix in the full resolution one, only around each corner
+     * @param minMarkerPixels 0 disables the automatic level. Calling pyrDown() disables it too
+     * @param maxLevel highest level it may choose
+     */
+    void setAutoPyrDown(unsigned int minMarkerPixels,unsigned int maxLevel=3)  {
+        _autoMinMarkerPixels=minMarkerPixels;
+        _autoMaxLevel=maxLevel;
+        _autoFrames=0;
+    }
+
+    ///level used by the last detect(), chosen by setAutoPyrDown() or set by pyrDown()
+    unsigned int getPyrDownLevel()const {return pyrdown_level;}
+
+    /**Level for the next image, chosen by setAutoPyrDown() or set by pyrDown(). detect() uses it on its own.
+     * A caller that reduces and thresholds the image itself asks it once per frame, and gives the level to
+     * detectThresholded(). Only the calls on the whole image count as frames for the automatic level
+     */
+    unsigned int nextPyrDownLevel();
+
+    static const int AUTO_PYRDOWN_FRAMES=8;
+
+    /** A candidate with its corners at most maxMove pixels from those of a marker detected in the last frame
+     * takes the id and rotation of that marker, with no warp and no decoding. A marker is decoded again
+     * at least once every frames frames, and as soon as it moves or deforms more than maxMove.
+     * The corners are compared in the coordinates of the whole image, so the calls may get different regions
+     * of the same image, like detectThresholded() on regions around the last markers. A call only replaces
+     * the known markers of its region. See beginFrame() for what a frame is
+     * @param frames 0 disables the cache. By default 10
+     * @param maxMove largest distance of a corner. By default 2 pixels
+     */
+    void setIdentityCache(unsigned int frames,float maxMove=2)  {
+        _identityCacheFrames=frames;
+        _identityCacheMaxMove=maxMove;
+        _knownMarkers.clear();
+    }
+    unsigned int getIdentityCacheFrames()const {return _identityCacheFrames;}
+    /** Starts a frame for the identity cache, before the calls that detect in it, as when each region of the
+     * frame has its own call. Until it is called once, every call is a frame
+     */
+    void beginFrame() {
+        _cacheFrame++;
+        _explicitFrames=true;
+    }
+
+    ///Tests that reject a candidate, in the order they run. All but REJECT_DECODE run before any warp or decoding
+    enum CandidateRejection {
+        REJECT_BORDER=0,//a corner in the border of the image, see _borderDistThres
+        REJECT_AREA,//too small to read its cells
+        REJECT_ASPECT,//a side much shorter than another
+        REJECT_CONTOUR,//the area of the contour is not that of its quad, it is not a quadrilateral
+        REJECT_CONTRAST,//the border of the quad is not darker than its surroundings
+        REJECT_DECODE,//passed the tests above, but has no valid id
+        N_CANDIDATE_REJECTIONS
+    };
+    /**Smallest difference of the mean gray level just outside a candidate and in its black border, sampled
+     * at a few points, for it to be decoded. 0 disables the test. By default 20
+     */
+    void setMinBorderContrast(int levels){_minBorderContrast=levels;}
+    int getMinBorderContrast()const {return _minBorderContrast;}
+    ///candidates rejected by test since the detector was created or resetRejections() was called
+    unsigned int getRejections(CandidateRejection test)const {return _rejections[test];}
+    void resetRejections() {
+        for(int i=0;i<N_CANDIDATE_REJECTIONS;i++) _rejections[i]=0;
     }
 
     ///-------------------------------------------------
@@ -279,8 +410,23 @@ public:
     /**Returns a list candidates to be markers (rectangles), for which no valid id was found after
      * calling detectRectangles
      */
-    const vector<std::vector<cv::Point2f> > &getCandidates() {
-        return _candidates;
+    const vector<std::vector<cv::Point2f> > &getCandidates();
+
+    /**Returns how many times the internal workspace had to grow since the detector was created.
+     * The workspace is kept between calls, so once it has seen the busiest frame this value
+     * stops changing and detect() does not allocate for it anymore.
+     * Reuse the same detectedMarkers vector between calls to avoid reallocating the output too.
+     * It counts the buffers of the detector, with any corner refinement method, not the heap: the OpenCV
+     * functions it calls allocate on their own, findContours(), cornerSubPix(), solvePnP() for the pose, and
+     * undistortPoints() and projectPoints() in the LINES refinement when the camera has distortion coefficients.
+     * The bench counts every heap allocation with --check-growths.
+     */
+    unsigned int getWorkspaceGrowths()const {
+        unsigned int growths=_workspaceGrowths;
+        for(size_t i=0;i<_threadWorkspace.size();i++) growths+=_threadWorkspace[i].growths;
+        for(size_t i=0;i<_contourStripes.size();i++) growths+=_contourStripes[i].growths;
+        for(size_t i=0;i<_contourSeams.size();i++) growths+=_contourSeams[i].growths;
+        return growths;
     }
 
     /**Given the iput image with markers, creates an output image with it in the canonical position
@@ -290,7 +436,7 @@ public:
      * @param points 4 corners of the marker in the image in
      * @return true if the operation succeed
      */
-    bool warp(cv::Mat &in,cv::Mat &out,cv::Size size, std::vector<cv::Point2f> points)throw (cv::Exception);
+    bool warp(cv::Mat &in,cv::Mat &out,cv::Size size, const std::vector<cv::Point2f> &points)throw (cv::Exception);
     
     
     
@@ -328,9 +474,52 @@ private:
      bool warp_cylinder ( cv::Mat &in,cv::Mat &out,cv::Size size, MarkerCandidate& mc ) throw ( cv::Exception );
     /**
     * Detection of candidates to be markers, i.e., rectangles.
-    * This function returns in candidates all the rectangles found in a thresolded image
+    * Leaves in the first _nMarkerCandidates elements of _markerCandidates all the rectangles found in a thresolded image
+    */
+    void findCandidates(const cv::Mat &thresImg);
+    /**
+    * Leaves in contours2 the contours of a thresolded image, the same ones a single findContours would find,
+    * except some of those with maxContourSize points or more, which are not candidates anyway.
+    * The image is traced in horizontal stripes in parallel, and the contours cut by the limit
+    * of a stripe are traced again in a region around the seam that contains them whole. When those
+    * regions cover much of the image, it is traced whole instead, and so are the next frames for a while
+    */
+    void traceContours(const cv::Mat &thresImg,size_t maxContourSize);
+    ///the stripes of traceContours(). Returns false, with nothing in contours2, if the seams are too large
+    bool traceContourStripes(const cv::Mat &thresImg,int nStripes,size_t maxContourSize);
+    /**
+    * Warps and decodes the candidates. The valid ones go to _found, the rest to _rejected
+    */
+    void identifyCandidates ( const cv::Mat &camMatrix,const cv::Mat &distCoeff );
+    /**
+    * Identification, corner refinement, removal of duplicates and pose. Common to detect() and detectThresholded()
+    */
+    void finishDetection ( std::vector<Marker> &detectedMarkers,const cv::Mat &camMatrix,const cv::Mat &distCoeff,float markerSizeMeters,bool setYPerpendicular,int pyrLevel );
+    /**
+    * Moves the candidates found in a reduced image of that pyrDown() level to the full resolution one
+    */
+    void scaleCandidates ( int level );
+    /**
+    * Common to all detectThresholded()
     */
-    void detectRectangles(const cv::Mat &thresImg,vector<MarkerCandidate> & candidates);
+    void detectThresholdedLevel ( const cv::Mat &greyImg,const cv::Mat &thresImg,unsigned int thresLevel,std::vector<Marker> &detectedMarkers,const cv::Mat &camMatrix,const cv::Mat &distCoeff,float markerSizeMeters,bool setYPerpendicular );
+    /**
+    * Refines the corners of a candidate on grey. level>0 if they were found in a reduced image of that pyrDown() level
+    */
+    void refineCorners ( MarkerCandidate &candidate,int level );
+    /**
+    * Id of the known marker with the corners of the candidate, or -1. Gives the rotation and the frame the id was decoded in
+    */
+    int findKnownMarker ( const MarkerCandidate &candidate,int &nRotations,unsigned int &decodedFrame ) const;
+    /**
+    * First of the cheap tests a candidate fails, or N_CANDIDATE_REJECTIONS if it passes them all and must be decoded
+    */
+    CandidateRejection rejectEarly ( const MarkerCandidate &candidate ) const;
+    /**
+    * Level of the automatic pyrDown() for the next frame, and the record of the markers it uses
+    */
+    int autoPyrDownLevel();
+    void recordMarkerSides(const std::vector<Marker> &markers);
     //Current threshold method
     ThresholdMethods _thresMethod;
     //Threshold parameters
@@ -343,13 +532,121 @@ private:
     int _speed;
     int _markerWarpSize;
     bool _doErosion;
+    bool _cellSampling;
     float _borderDistThres;//border around image limits in which corners are not allowed to be detected.
     //vectr of candidates to be markers. This is a vector with a set of rectangles that have no valid id
     vector<std::vector<cv::Point2f> > _candidates;
     //level of image reduction
     int pyrdown_level;
+    //automatic level: smallest side wanted, highest level, frames detected and smallest side found in the last ones (0 if none)
+    unsigned int _autoMinMarkerPixels,_autoMaxLevel,_autoFrames;
+    float _recentMinSides[AUTO_PYRDOWN_FRAMES];
     //Images
     cv::Mat grey,thres,thres2,reduced;
+    vector<cv::Mat> _pyramid;
+
+    //A marker found while identifying the candidates
+    struct FoundMarker {
+        int candidate;//index in _markerCandidates
+        int id;
+        unsigned int decodedFrame;//frame its id was decoded in
+    };
+    //A marker detected in a recent frame, for the identity cache
+    struct KnownMarker {
+        cv::Point2f corners[4];//as identified, before the corner refinement, in the order of the marker and in whole image coordinates
+        int id;
+        unsigned int decodedFrame;
+    };
+    struct FoundMarkerIdLess {
+        bool operator()(const FoundMarker &a,const FoundMarker &b)const { return a.id<b.id || (a.id==b.id && a.candidate<b.candidate); }
+    };
+    //Scratch data of each thread identifying candidates
+    struct ThreadWorkspace {
+        ThreadWorkspace():nRectangles(0),growths(0){}
+        vector<cv::Point> approxCurve;
+        vector<MarkerCandidate> rectangles;//pool with the rectangles found by this thread
+        size_t nRectangles;
+        cv::Mat canonicalMarker;
+        vector<FoundMarker> found;
+        vector<int> rejected;
+        vector<pair<int,int> > tooNear;
+        vector<cv::Point2f> contour2f,contourLines[4];//LINES refinement
+        unsigned int rejections[N_CANDIDATE_REJECTIONS];//of the last call
+        unsigned int growths;
+    };
+
+    //Contours of a region of the thresholded image, a stripe or a region around a seam
+    struct ContourRegion {
+        ContourRegion():growths(0){}
+        ///copies the region of the image and traces its contours, in image coordinates
+        void trace(const cv::Mat &thresImg);
+        cv::Rect roi;
+        cv::Mat image;
+        std::vector<std::vector<cv::Point> > contours;
+        std::vector<cv::Vec4i> hierarchy;
+        vector<int> kept;//contours that are complete in this region
+        vector<cv::Rect> cut;//bounding boxes of the contours cut by the limits of the region
+        unsigned int growths;
+    };
+
+    ///Detection workspace. Everything here is kept between calls and only grows, so a frame
+    ///like the previous ones does not allocate. Pools keep their elements, and the buffers inside
+    ///them, and are used up to a count instead of being cleared
+    std::vector<std::vector<cv::Point> > contours2;
+    std::vector<cv::Vec4i> hierarchy2;
+    vector<MarkerCandidate> _rectangles;//pool with the rectangles found in the contours
+    size_t _nRectangles;
+    vector<MarkerCandidate> _markerCandidates;//pool with the rectangles that were not too near another one
+    size_t _nMarkerCandidates;
+    vector<char> _swapped,_tooNearRemove,_toRemove;
+    vector<pair<int,int> > _tooNear;
+    vector<int> _gridCell,_gridStart,_gridFill,_gridMembers;//grid of the rectangle centers, to find the ones too near
+    vector<ThreadWorkspace> _threadWorkspace;
+    vector<ContourRegion> _contourStripes,_contourSeams;
+    vector<int> _stripeLimits;//first row of each stripe, and the number of rows at the end
+    vector<cv::Rect> _seamRegions;
+    bool _parallelContours;
+    unsigned int _serialContourFrames;//left to trace whole
+    vector<FoundMarker> _found;
+    vector<int> _rejected;
+    //identity cache: frames a decoded id is kept, largest move, current frame and whether the caller counts them,
+    //known markers and those of this call, size of the whole image they are in and offset of grey in it
+    unsigned int _identityCacheFrames;
+    float _identityCacheMaxMove;
+    unsigned int _cacheFrame;
+    bool _explicitFrames;
+    vector<KnownMarker> _knownMarkers,_newKnownMarkers;
+    cv::Size _knownImageSize;
+    cv::Point _greyOffset;
+    vector<Marker> _poses;//pose of each element of _found, computed before the duplicates are removed
+    TaskGraph _taskGraph;//corner refinement and pose of the markers of a frame
+    //what the tasks of _taskGraph need besides the index of the marker
+    int _refineLevel;
+    cv::Mat _poseCamMatrix,_poseDistCoeff;
+    float _poseMarkerSize;
+    bool _poseYPerpendicular;
+    int _minBorderContrast;
+    unsigned int _rejections[N_CANDIDATE_REJECTIONS];//candidates rejected by each test
+    unsigned int _workspaceGrowths;
+
+    template<typename T> T & nextInPool(vector<T> &pool,size_t &n) {
+        return nextInPool(pool,n,_workspaceGrowths);
+    }
+    template<typename T> T & nextInPool(vector<T> &pool,size_t &n,unsigned int &growths) {
+        if (n==pool.size()) {
+            pool.push_back(T());
+            growths++;
+        }
+        return pool[n++];
+    }
+    template<typename T> void pushBack(vector<T> &v,const T &e,unsigned int &growths) {
+        if (v.size()==v.capacity()) growths++;
+        v.push_back(e);
+    }
+    template<typename T> void assignWorkspace(vector<T> &v,size_t n,const T &value) {
+        if (n>v.capacity()) _workspaceGrowths++;
+        v.assign(n,value);
+    }
     //pointer to the function that analizes a rectangular region so as to detect its internal marker
     int (* markerIdDetector_ptrfunc)(const cv::Mat &in,int &nRotations);
 
@@ -377,6 +674,7 @@ private:
     // auxiliar functions to perform LINES refinement
     void interpolate2Dline( const vector< cv::Point2f > &inPoints, cv::Point3f &outLine);
     cv::Point2f getCrossPoint(const cv::Point3f& line1, const cv::Point3f& line2);      
+    void refineCandidateLines(MarkerCandidate &candidate, const cv::Mat &camMatrix, const cv::Mat &distCoeff, ThreadWorkspace &ws);
 
     void distortPoints(vector<cv::Point2f> in,
                        vector<cv::Point2f> &out,
@@ -0,0 +1,132 @@
+#include "allocationcounter.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    std::atomic< bool > counting( false );
+    std::atomic< quint64 > allocations( 0 );
+
+    inline void count()
+    {
+        if( counting.load( std::memory_order_relaxed ) )
+            allocations.fetch_add( 1, std::memory_order_relaxed );
+    }
+}
+
+void setAllocationCounting( bool enabled )
+{
+    counting.store( enabled );
+}
+
+quint64 allocationCount()
+{
+    return allocations.load();
+}
+
+#ifdef __GLIBC__
+
+// glibc keeps its allocator under these names, operator new and the shared libraries end up here
+extern "C"
+{
+    void *__libc_malloc( size_t size );
+    void *__libc_calloc( size_t count, size_t size );
+    void *__libc_realloc( void *pointer, size_t size );
+    void *__libc_memalign( size_t alignment, size_t size );
+    void __libc_free( void *pointer );
+
+    void *malloc( size_t size )
+    {
+        count();
+        return __libc_malloc( size );
+    }
+
+    void *calloc( size_t number, size_t size )
+    {
+        count();
+        return __libc_calloc( number, size );
+    }
+
+    void *realloc( void *pointer, size_t size )
+    {
+        count();
+        return __libc_realloc( pointer, size );
+    }
+
+    void *memalign( size_t alignment, size_t size )
+    {
+        count();
+        return __libc_memalign( alignment, size );
+    }
+
+    void *aligned_alloc( size_t alignment, size_t size )
+    {
+        return memalign( alignment, size );
+    }
+
+    int posix_memalign( void **result, size_t alignment, size_t size )
+    {
+        void *pointer = memalign( alignment, size );
+        if( !pointer )
+            return ENOMEM;
+        *result = pointer;
+        return 0;
+    }
+
+    void free( void *pointer )
+    {
+        __libc_free( pointer );
+    }
+}
+
+#else
+
+void *operator new( size_t size )
+{
+    count();
+    void *pointer = std::malloc( size ? size : 1 );
+    if( !pointer )
+        throw std::bad_alloc();
+    return pointer;
+}
+
+void *operator new[]( size_t size )
+{
+    return operator new( size );
+}
+
+void *operator new( size_t size, const std::nothrow_t & ) throw()
+{
+    count();
+    return std::malloc( size ? size : 1 );
+}
+
+void *operator new[]( size_t size, const std::nothrow_t &nothrow ) throw()
+{
+    return operator new( size, nothrow );
+}
+
+void operator delete( void *pointer ) throw()
+{
+    std::free( pointer );
+}
+
+void operator delete[]( void *pointer ) throw()
+{
+    std::free( pointer );
+}
+
+void operator delete( void *pointer, const std::nothrow_t & ) throw()
+{
+    std::free( pointer );
+}
+
+void operator delete[]( void *pointer, const std::nothrow_t & ) throw()
+{
+    std::free( pointer );
+}
+
+#endif
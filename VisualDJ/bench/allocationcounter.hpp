@@ -0,0 +1,12 @@
+#ifndef ALLOCATIONCOUNTER_HPP
+#define ALLOCATIONCOUNTER_HPP
+
+#include <QtGlobal>
+
+// Heap allocations of every thread of the process, while counting is on. With glibc the
+// malloc family is replaced, so the allocations of OpenCV and Qt count too, the same as
+// new. Elsewhere only operator new is replaced. Only linked into the bench
+void setAllocationCounting( bool enabled );
+quint64 allocationCount();
+
+#endif // ALLOCATIONCOUNTER_HPP
@@ -0,0 +1,267 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QFileInfo>
+#include <QThread>
+#include <QVector>
+
+#include "framesource.hpp"
+#include "framedetector.hpp"
+#include "compositor.hpp"
+#include "pipeline.hpp"
+#include "latencyrecord.hpp"
+#include "allocationcounter.hpp"
+#include "aruco/ar_timers.h"
+
+// Same calibration the scene starts with
+#define RESOLUTION_RELATION     2.14
+#define HORIZONTAL_DISPLACEMENT -15
+#define VERTICAL_DISPLACEMENT   -94
+
+// What Scene::slotProcess does with the volumes, so the bench pays for it too
+static void applyVolumes( const Frame &frame, QVector< int > &soundVolumes )
+{
+    for( int i = 0; i < soundVolumes.size(); i++ )
+    {
+        int volume = i < frame.volumes.size() ? frame.volumes.at( i ) : Frame::NOT_DETECTED;
+        soundVolumes[ i ] = volume != Frame::NOT_DETECTED ? volume : qMax( 0, soundVolumes.at( i ) - 5 );
+    }
+}
+
+int main( int argc, char **argv )
+{
+    QCoreApplication application( argc, argv );
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription( "Runs detection and overlay drawing over a recording, with no window, "
+                                      "and reports the latency per frame and the frames per second." );
+    parser.addHelpOption();
+    parser.addPositionalArgument( "source", "Video file or directory of images." );
+
+    QCommandLineOption cameraParametersOption( "camera-parameters", "Camera calibration file.", "file",
+                                               "../files/camera_parameters.yml" );
+    QCommandLineOption soundsOption( "sounds", "Sounds mapped to markers 0..n-1 (default 8).", "count", "8" );
+    QCommandLineOption warmupOption( "warmup", "Frames left out of the statistics (default 10).", "count", "10" );
+    QCommandLineOption pipelineOption( "pipeline", "Run the threaded pipeline instead of one frame at a time. "
+                                                   "Latency is then measured from capture to render." );
+    QCommandLineOption threadsOption( "detection-threads", "Detection threads of the pipeline (default 1).", "count", "1" );
+    QCommandLineOption rescanOption( "rescan-interval", "Frames between searches of the whole frame, the ones in "
+                                                        "between only search around the markers found (default 10).",
+                                     "frames", "10" );
+    QCommandLineOption noOpticalFlowOption( "no-optical-flow", "Do not follow the markers with optical flow "
+                                                               "between searches of the whole frame." );
+    QCommandLineOption noChangeDetectionOption( "no-change-detection", "Search the frame even where it did not "
+                                                                       "change since the last search." );
+    QCommandLineOption reduceOption( "reduce-resolution", "Look for the markers in a reduced image, as small as the "
+                                                          "smallest marker keeps this many pixels per side "
+                                                          "(default 0, full resolution).", "pixels", "0" );
+    QCommandLineOption serialContoursOption( "serial-contours", "Trace the contours of the whole frame in one "
+                                                                "thread, to compare with the parallel stripes." );
+    QCommandLineOption checkGrowthsOption( "check-growths", "Fail if the detection allocates from the heap after the "
+                                                            "warmup frames, or if the detector workspace grows. "
+                                                            "One frame at a time only." );
+    QCommandLineOption traceOption( "trace", "Write a timeline of the processing stages to file, "
+                                             "for chrome://tracing or Perfetto.", "file" );
+
+    parser.addOption( cameraParametersOption );
+    parser.addOption( soundsOption );
+    parser.addOption( warmupOption );
+    parser.addOption( pipelineOption );
+    parser.addOption( threadsOption );
+    parser.addOption( rescanOption );
+    parser.addOption( noOpticalFlowOption );
+    parser.addOption( noChangeDetectionOption );
+    parser.addOption( reduceOption );
+    parser.addOption( serialContoursOption );
+    parser.addOption( checkGrowthsOption );
+    parser.addOption( traceOption );
+    parser.process( application );
+
+    QTextStream out( stdout );
+
+    if( parser.positionalArguments().size() != 1 )
+        parser.showHelp( 1 );
+
+    QString sourcePath = parser.positionalArguments().first();
+    FrameSource *frameSource;
+    if( QFileInfo( sourcePath ).isDir() )
+        frameSource = new ImageDirectorySource( sourcePath, 30 );
+    else
+        frameSource = new VideoFileSource( sourcePath );
+
+    if( !frameSource->isOpened() )
+    {
+        out << "Could not open " << frameSource->getDescription() << "\n";
+        delete frameSource;
+        return 1;
+    }
+
+    // Every frame is processed, the results do not depend on the machine speed
+    frameSource->setRealTime( false );
+
+    CameraParameters cameraParameters;
+    cameraParameters.readFromXMLFile( parser.value( cameraParametersOption ).toStdString() );
+
+    QStringList soundNames;
+    for( int i = 0; i < parser.value( soundsOption ).toInt(); i++ )
+        soundNames << "sound_" + QString::number( i ) + ".mp3";
+    QVector< int > soundVolumes( soundNames.size(), 100 );
+
+    int warmup = parser.value( warmupOption ).toInt();
+    int frames = 0;
+    int detectedMarkers = 0;
+
+    LatencyRecord totalLatency( "total" );
+    LatencyRecord detectLatency( "detect" );
+    LatencyRecord compositeLatency( "composite" );
+
+    QElapsedTimer elapsedTimer;
+    qint64 elapsed = 0;
+
+    // Workspace growths of the detector at the end of the warmup and at the end, and heap
+    // allocations during the detection of the measured frames, one frame at a time
+    unsigned int warmupGrowths = 0;
+    unsigned int growths = 0;
+    quint64 detectAllocations = 0;
+    setAllocationCounting( parser.isSet( checkGrowthsOption ) );
+
+    if( parser.isSet( traceOption ) )
+    {
+        aruco::Tracer::start();
+        aruco::Tracer::setThreadName( "bench" );
+    }
+
+    if( parser.isSet( pipelineOption ) )
+    {
+        Pipeline pipeline( frameSource, cameraParameters, parser.value( threadsOption ).toInt() );
+        pipeline.getCompositor()->setSounds( soundNames );
+        pipeline.getCompositor()->setCalibration( RESOLUTION_RELATION, HORIZONTAL_DISPLACEMENT, VERTICAL_DISPLACEMENT );
+        pipeline.setRescanInterval( parser.value( rescanOption ).toInt() );
+        pipeline.setOpticalFlow( !parser.isSet( noOpticalFlowOption ) );
+        pipeline.setChangeDetection( !parser.isSet( noChangeDetectionOption ) );
+        pipeline.setParallelContours( !parser.isSet( serialContoursOption ) );
+        pipeline.setAutoReduction( parser.value( reduceOption ).toInt() );
+
+        pipeline.start();
+
+        // Restarted at the end of each warmup frame, this start only counts with no warmup
+        elapsedTimer.start();
+
+        Frame frame;
+        while( !pipeline.isFinished() )
+        {
+            if( !pipeline.takeFrame( frame ) )
+            {
+                QThread::usleep( 100 );
+                continue;
+            }
+
+            applyVolumes( frame, soundVolumes );
+            qint64 renderedAt = Frame::now();
+
+            // The clock and the stage timers start with the first measured frame, warmup frames do not count
+            if( frames++ < warmup )
+            {
+                elapsedTimer.start();
+                aruco::Timers::reset();
+                continue;
+            }
+
+            detectedMarkers += frame.markers.size();
+            totalLatency.append( renderedAt - frame.capturedAt );
+            detectLatency.append( frame.detectedAt - frame.capturedAt );
+            compositeLatency.append( frame.compositedAt - frame.detectedAt );
+        }
+
+        elapsed = elapsedTimer.nsecsElapsed();
+        pipeline.stop();
+    }
+    else
+    {
+        FrameDetector frameDetector( cameraParameters );
+        frameDetector.setRescanInterval( parser.value( rescanOption ).toInt() );
+        frameDetector.setOpticalFlow( !parser.isSet( noOpticalFlowOption ) );
+        frameDetector.setChangeDetection( !parser.isSet( noChangeDetectionOption ) );
+        frameDetector.getMarkerDetector()->enableParallelContours( !parser.isSet( serialContoursOption ) );
+        frameDetector.setAutoReduction( parser.value( reduceOption ).toInt() );
+        Compositor compositor( 1 );
+        compositor.setSounds( soundNames );
+        compositor.setCalibration( RESOLUTION_RELATION, HORIZONTAL_DISPLACEMENT, VERTICAL_DISPLACEMENT );
+
+        elapsedTimer.start();
+
+        Frame frame;
+        while( frameSource->read( frame.image ) )
+        {
+            aruco::Tracer::setFrame( frames );
+            frame.id = frames;
+            frame.capturedAt = Frame::now();
+            quint64 allocationsBefore = allocationCount();
+            frameDetector.process( frame );
+            quint64 allocations = allocationCount() - allocationsBefore;
+            frame.detectedAt = Frame::now();
+            compositor.process( frame );
+            frame.compositedAt = Frame::now();
+            applyVolumes( frame, soundVolumes );
+            qint64 renderedAt = Frame::now();
+
+            if( frames++ < warmup )
+            {
+                elapsedTimer.start();
+                aruco::Timers::reset();
+                warmupGrowths = frameDetector.getMarkerDetector()->getWorkspaceGrowths();
+                continue;
+            }
+
+            detectedMarkers += frame.markers.size();
+            detectAllocations += allocations;
+            totalLatency.append( renderedAt - frame.capturedAt );
+            detectLatency.append( frame.detectedAt - frame.capturedAt );
+            compositeLatency.append( frame.compositedAt - frame.detectedAt );
+        }
+
+        elapsed = elapsedTimer.nsecsElapsed();
+        growths = frameDetector.getMarkerDetector()->getWorkspaceGrowths();
+    }
+
+    int measured = qMax( 0, frames - warmup );
+
+    out << frameSource->getDescription() << "\n"
+        << ( parser.isSet( pipelineOption ) ? "pipeline, " + parser.value( threadsOption ) + " detection threads"
+                                            : QString( "one frame at a time" ) ) << "\n"
+        << "frames " << measured << " (+" << qMin( frames, warmup ) << " warmup)"
+        << "  markers per frame " << QString::number( measured ? detectedMarkers / ( double )measured : 0, 'f', 2 )
+        << "  fps " << QString::number( elapsed > 0 ? measured * 1e9 / elapsed : 0, 'f', 1 ) << "\n";
+
+    totalLatency.print( out );
+    detectLatency.print( out );
+    compositeLatency.print( out );
+    out << "\nstages\n" << QString::fromStdString( aruco::Timers::report() );
+
+    if( parser.isSet( traceOption ) )
+    {
+        aruco::Tracer::stop();
+        if( !aruco::Tracer::write( parser.value( traceOption ).toStdString() ) )
+            out << "Could not write " << parser.value( traceOption ) << "\n";
+    }
+
+    delete frameSource;
+
+    if( parser.isSet( checkGrowthsOption ) )
+    {
+        if( parser.isSet( pipelineOption ) )
+        {
+            out << "--check-growths needs one frame at a time\n";
+            return 1;
+        }
+
+        out << "workspace growths " << warmupGrowths << " in the warmup, " << growths - warmupGrowths << " after\n"
+            << "heap allocations in the detection " << detectAllocations << ", "
+            << QString::number( measured ? detectAllocations / ( double )measured : 0, 'f', 1 ) << " per frame\n";
+        if( growths != warmupGrowths || detectAllocations > 0 )
+            return 2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,24 @@
+#-------------------------------------------------
+#
+# Benchmark sin ventana: deteccion y composicion sobre un video o un
+# directorio de imagenes. Informa latencias por frame y frames por segundo
+#
+#-------------------------------------------------
+
+QT += core
+QT -= gui
+
+CONFIG += console
+CONFIG -= app_bundle
+
+TARGET = visualdj_bench
+TEMPLATE = app
+
+include( ../opencv.pri )
+include( ../aruco/aruco.pri )
+include( ../pipeline.pri )
+
+SOURCES += main.cpp \
+           allocationcounter.cpp
+
+HEADERS += allocationcounter.hpp
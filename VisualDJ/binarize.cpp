@@ -0,0 +1,198 @@
+#include "binarize.hpp"
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+    #define BINARIZE_X86
+    #include <immintrin.h>
+#endif
+
+// Same fixed point weights and rounding as cvtColor, so the grayscale is identical
+#define GRAY_SHIFT  14
+#define B_WEIGHT    1868
+#define G_WEIGHT    9617
+#define R_WEIGHT    4899
+#define ROUNDING    ( 1 << ( GRAY_SHIFT - 1 ) )
+
+namespace
+{
+    void binarizeRow( const uchar *bgr, uchar *grayscale, uchar *binary, int from, int width, int threshold )
+    {
+        for( int x = from; x < width; x++ )
+        {
+            const uchar *pixel = bgr + 3 * x;
+            int gray = ( pixel[ 0 ] * B_WEIGHT + pixel[ 1 ] * G_WEIGHT + pixel[ 2 ] * R_WEIGHT + ROUNDING ) >> GRAY_SHIFT;
+            grayscale[ x ] = gray;
+            binary[ x ] = gray <= threshold ? 255 : 0;
+        }
+    }
+
+#ifdef BINARIZE_X86
+
+    // Splits 16 interleaved BGR pixels, 48 bytes, into 16 bytes of each channel
+    __attribute__(( target( "ssse3" ) ))
+    inline void deinterleave( const uchar *bgr, __m128i &b, __m128i &g, __m128i &r )
+    {
+        __m128i a0 = _mm_loadu_si128( ( const __m128i * )bgr );
+        __m128i a1 = _mm_loadu_si128( ( const __m128i * )( bgr + 16 ) );
+        __m128i a2 = _mm_loadu_si128( ( const __m128i * )( bgr + 32 ) );
+
+        b = _mm_or_si128( _mm_or_si128(
+            _mm_shuffle_epi8( a0, _mm_setr_epi8( 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 ) ),
+            _mm_shuffle_epi8( a1, _mm_setr_epi8( -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1 ) ) ),
+            _mm_shuffle_epi8( a2, _mm_setr_epi8( -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13 ) ) );
+        g = _mm_or_si128( _mm_or_si128(
+            _mm_shuffle_epi8( a0, _mm_setr_epi8( 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 ) ),
+            _mm_shuffle_epi8( a1, _mm_setr_epi8( -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1 ) ) ),
+            _mm_shuffle_epi8( a2, _mm_setr_epi8( -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14 ) ) );
+        r = _mm_or_si128( _mm_or_si128(
+            _mm_shuffle_epi8( a0, _mm_setr_epi8( 2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 ) ),
+            _mm_shuffle_epi8( a1, _mm_setr_epi8( -1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1 ) ) ),
+            _mm_shuffle_epi8( a2, _mm_setr_epi8( -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15 ) ) );
+    }
+
+    // Weighted sum of 4 pixels in 32 bits. b, g and r hold 16 bit channels, the first 4 are used.
+    // Each pair ( B, G ) and ( R, 1 ) is multiplied by ( B_WEIGHT, G_WEIGHT ) and ( R_WEIGHT, ROUNDING )
+    __attribute__(( target( "ssse3" ) ))
+    inline __m128i weigh( __m128i bg, __m128i r1 )
+    {
+        const __m128i bgWeights = _mm_set1_epi32( ( G_WEIGHT << 16 ) | B_WEIGHT );
+        const __m128i rWeights = _mm_set1_epi32( ( ROUNDING << 16 ) | R_WEIGHT );
+        return _mm_srli_epi32( _mm_add_epi32( _mm_madd_epi16( bg, bgWeights ), _mm_madd_epi16( r1, rWeights ) ), GRAY_SHIFT );
+    }
+
+    __attribute__(( target( "ssse3" ) ))
+    int binarizeRowSsse3( const uchar *bgr, uchar *grayscale, uchar *binary, int width, int threshold )
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one = _mm_set1_epi16( 1 );
+        const __m128i limit = _mm_set1_epi8( ( char )threshold );
+
+        int x = 0;
+        for( ; x + 16 <= width; x += 16 )
+        {
+            __m128i b, g, r;
+            deinterleave( bgr + 3 * x, b, g, r );
+
+            __m128i b0 = _mm_unpacklo_epi8( b, zero ), b1 = _mm_unpackhi_epi8( b, zero );
+            __m128i g0 = _mm_unpacklo_epi8( g, zero ), g1 = _mm_unpackhi_epi8( g, zero );
+            __m128i r0 = _mm_unpacklo_epi8( r, zero ), r1 = _mm_unpackhi_epi8( r, zero );
+
+            __m128i gray0 = _mm_packs_epi32( weigh( _mm_unpacklo_epi16( b0, g0 ), _mm_unpacklo_epi16( r0, one ) ),
+                                             weigh( _mm_unpackhi_epi16( b0, g0 ), _mm_unpackhi_epi16( r0, one ) ) );
+            __m128i gray1 = _mm_packs_epi32( weigh( _mm_unpacklo_epi16( b1, g1 ), _mm_unpacklo_epi16( r1, one ) ),
+                                             weigh( _mm_unpackhi_epi16( b1, g1 ), _mm_unpackhi_epi16( r1, one ) ) );
+            __m128i gray = _mm_packus_epi16( gray0, gray1 );
+
+            _mm_storeu_si128( ( __m128i * )( grayscale + x ), gray );
+            _mm_storeu_si128( ( __m128i * )( binary + x ), _mm_cmpeq_epi8( _mm_min_epu8( gray, limit ), gray ) );
+        }
+        return x;
+    }
+
+    // 16 pixels to 16 bit grays, in order
+    __attribute__(( target( "avx2" ) ))
+    inline __m256i weigh16( __m128i b, __m128i g, __m128i r )
+    {
+        const __m256i bgWeights = _mm256_set1_epi32( ( G_WEIGHT << 16 ) | B_WEIGHT );
+        const __m256i rWeights = _mm256_set1_epi32( ( ROUNDING << 16 ) | R_WEIGHT );
+        const __m256i one = _mm256_set1_epi16( 1 );
+
+        __m256i b16 = _mm256_cvtepu8_epi16( b );
+        __m256i g16 = _mm256_cvtepu8_epi16( g );
+        __m256i r16 = _mm256_cvtepu8_epi16( r );
+
+        // Pixels 0-3 and 8-11, then 4-7 and 12-15. The pack puts them back in order
+        __m256i low = _mm256_add_epi32( _mm256_madd_epi16( _mm256_unpacklo_epi16( b16, g16 ), bgWeights ),
+                                        _mm256_madd_epi16( _mm256_unpacklo_epi16( r16, one ), rWeights ) );
+        __m256i high = _mm256_add_epi32( _mm256_madd_epi16( _mm256_unpackhi_epi16( b16, g16 ), bgWeights ),
+                                         _mm256_madd_epi16( _mm256_unpackhi_epi16( r16, one ), rWeights ) );
+        return _mm256_packs_epi32( _mm256_srli_epi32( low, GRAY_SHIFT ), _mm256_srli_epi32( high, GRAY_SHIFT ) );
+    }
+
+    __attribute__(( target( "avx2" ) ))
+    int binarizeRowAvx2( const uchar *bgr, uchar *grayscale, uchar *binary, int width, int threshold )
+    {
+        const __m256i limit = _mm256_set1_epi8( ( char )threshold );
+
+        int x = 0;
+        for( ; x + 32 <= width; x += 32 )
+        {
+            __m128i b0, g0, r0, b1, g1, r1;
+            deinterleave( bgr + 3 * x, b0, g0, r0 );
+            deinterleave( bgr + 3 * x + 48, b1, g1, r1 );
+
+            // The pack works inside each 128 bit half, the permutation restores the pixel order
+            __m256i gray = _mm256_permute4x64_epi64( _mm256_packus_epi16( weigh16( b0, g0, r0 ), weigh16( b1, g1, r1 ) ), 0xD8 );
+
+            _mm256_storeu_si256( ( __m256i * )( grayscale + x ), gray );
+            _mm256_storeu_si256( ( __m256i * )( binary + x ), _mm256_cmpeq_epi8( _mm256_min_epu8( gray, limit ), gray ) );
+        }
+        return x;
+    }
+
+    typedef int ( *RowKernel )( const uchar *, uchar *, uchar *, int, int );
+
+    RowKernel selectKernel()
+    {
+        __builtin_cpu_init();
+        if( __builtin_cpu_supports( "avx2" ) )
+            return binarizeRowAvx2;
+        if( __builtin_cpu_supports( "ssse3" ) )
+            return binarizeRowSsse3;
+        return 0;
+    }
+
+#endif
+}
+
+void binarize( const Mat &bgr, Mat &grayscale, Mat &binary, int threshold )
+{
+    CV_Assert( bgr.type() == CV_8UC3 );
+    CV_Assert( threshold >= 0 && threshold <= 255 );
+
+    grayscale.create( bgr.size(), CV_8UC1 );
+    binary.create( bgr.size(), CV_8UC1 );
+
+#ifdef BINARIZE_X86
+    static const RowKernel rowKernel = selectKernel();
+#endif
+
+    for( int y = 0; y < bgr.rows; y++ )
+    {
+        const uchar *bgrRow = bgr.ptr< uchar >( y );
+        uchar *grayscaleRow = grayscale.ptr< uchar >( y );
+        uchar *binaryRow = binary.ptr< uchar >( y );
+
+        // The vector kernels leave the last pixels of the row to the scalar one
+        int x = 0;
+#ifdef BINARIZE_X86
+        if( rowKernel )
+            x = rowKernel( bgrRow, grayscaleRow, binaryRow, bgr.cols, threshold );
+#endif
+        binarizeRow( bgrRow, grayscaleRow, binaryRow, x, bgr.cols, threshold );
+    }
+}
+
+void binarize( const Mat &bgr, Mat &grayscale, std::vector< Mat > &pyramid, Mat &binary, int level, int threshold )
+{
+    if( level <= 0 )
+    {
+        binarize( bgr, grayscale, binary, threshold );
+        return;
+    }
+
+    CV_Assert( bgr.type() == CV_8UC3 );
+    CV_Assert( threshold >= 0 && threshold <= 255 );
+
+    // The full resolution grayscale is still needed, to decode the markers and refine their corners
+    cvtColor( bgr, grayscale, CV_BGR2GRAY );
+
+    if( pyramid.size() < ( size_t )level )
+        pyramid.resize( level );
+    for( int i = 0; i < level; i++ )
+        pyrDown( i == 0 ? grayscale : pyramid.at( i - 1 ), pyramid[ i ] );
+
+    // 255 where <= threshold, like the full resolution version
+    cv::threshold( pyramid.at( level - 1 ), binary, threshold, 255, THRESH_BINARY_INV );
+}
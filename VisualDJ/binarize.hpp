@@ -0,0 +1,21 @@
+#ifndef BINARIZE_HPP
+#define BINARIZE_HPP
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+using namespace cv;
+
+// Converts a BGR frame to grayscale and thresholds it in the same pass over the image.
+// grayscale is the same as cvtColor( CV_BGR2GRAY ). binary is 255 where the grayscale
+// is <= threshold, the dark parts like the marker borders, and 0 elsewhere, which is
+// what MarkerDetector::detectThresholded() expects.
+// Uses AVX2 or SSSE3 when the processor has them.
+void binarize( const Mat &bgr, Mat &grayscale, Mat &binary, int threshold = 128 );
+
+// Same, but binary is thresholded from the level-th cv::pyrDown() of the grayscale, so it is
+// 2^level times smaller, for MarkerDetector::detectThresholded() with that level. pyramid keeps
+// the reduced levels between calls. Level 0 is the same as above.
+void binarize( const Mat &bgr, Mat &grayscale, std::vector< Mat > &pyramid, Mat &binary, int level, int threshold = 128 );
+
+#endif // BINARIZE_HPP
@@ -0,0 +1,79 @@
+#include "capturethread.hpp"
+#include "aruco/ar_timers.h"
+
+#define WAIT_TIMEOUT    20      // ms, how often a waiting capture checks if it must stop
+
+CaptureThread::CaptureThread( FrameSource *frameSource, FrameMailbox *mailbox, QObject *parent ) : QThread( parent ),
+                                                                                                    frameSource( frameSource ),
+                                                                                                    mailbox( mailbox ),
+                                                                                                    running( 1 ),
+                                                                                                    frameCount( 0 ),
+                                                                                                    nextFrameId( 0 )
+{
+}
+
+void CaptureThread::stop()
+{
+    running.store( 0 );
+    wait();
+}
+
+int CaptureThread::getFrameCount() const
+{
+    return frameCount.load();
+}
+
+void CaptureThread::run()
+{
+    bool paced = frameSource->isRealTime() && !frameSource->isLive();
+    bool lossless = frameSource->isLossless();
+    playbackTimer.start();
+    aruco::Tracer::setThreadName( "capture" );
+
+    while( running.load() )
+    {
+        Frame &frame = mailbox->writeBuffer();
+        aruco::Tracer::setFrame( nextFrameId );
+
+        // A detection stage may still hold the image this buffer had last time.
+        // Only the readers can drop references now, so a count of one means it is ours again
+        if( frame.image.u && frame.image.u->refcount > 1 )
+            frame.image.release();
+
+        bool frameRead;
+        {
+            ARUCO_SCOPED_TIMER( "CaptureThread::read" );
+            frameRead = frameSource->read( frame.image );
+        }
+
+        if( !frameRead )
+        {
+            if( frameSource->atEnd() )
+                break;
+
+            // Camera not ready or disconnected, do not spin
+            msleep( 5 );
+            continue;
+        }
+
+        if( paced )
+        {
+            // A recorded frame is not shown before its time in the recording
+            qint64 due = nextFrameId * 1000 / frameSource->getFps();
+            qint64 early = due - playbackTimer.elapsed();
+            if( early > 0 )
+                msleep( early );
+        }
+
+        if( lossless )
+        {
+            while( running.load() && !mailbox->waitUntilTaken( WAIT_TIMEOUT ) )
+                ;
+        }
+
+        frame.id = nextFrameId++;
+        frame.capturedAt = Frame::now();
+        mailbox->publish();
+        frameCount.fetchAndAddRelaxed( 1 );
+    }
+}
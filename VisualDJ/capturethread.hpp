@@ -0,0 +1,43 @@
+#ifndef CAPTURETHREAD_HPP
+#define CAPTURETHREAD_HPP
+
+#include <QThread>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+
+#include "framesource.hpp"
+#include "framemailbox.hpp"
+
+// Reads the frame source on its own thread so a blocking read never stalls the GUI thread.
+// Every frame is published to the mailbox, the pipeline picks up the newest one.
+// Recorded sources are paced to their fps in real time mode, and in lossless mode
+// each frame waits until the previous one was taken. The thread ends with the source.
+class CaptureThread : public QThread
+{
+    Q_OBJECT
+
+private:
+
+    FrameSource *frameSource;
+    FrameMailbox *mailbox;
+    QAtomicInt running;
+    QAtomicInt frameCount;
+    quint64 nextFrameId;
+
+    QElapsedTimer playbackTimer;
+
+public:
+
+    explicit CaptureThread( FrameSource *frameSource, FrameMailbox *mailbox, QObject *parent = 0 );
+
+    void stop();
+
+    // Frames published so far
+    int getFrameCount() const;
+
+protected:
+
+    void run();
+};
+
+#endif // CAPTURETHREAD_HPP
@@ -0,0 +1,177 @@
+#include "changedetector.hpp"
+#include "aruco/ar_timers.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+    #define CHANGE_X86
+    #include <immintrin.h>
+#endif
+
+namespace
+{
+    int rowDifference( const uchar *a, const uchar *b, int from, int width )
+    {
+        int sum = 0;
+        for( int x = from; x < width; x++ )
+            sum += std::abs( a[ x ] - b[ x ] );
+        return sum;
+    }
+
+#ifdef CHANGE_X86
+
+    // Sum of absolute differences, 16 pixels per instruction. Returns the sum of the
+    // first pixels, a multiple of 16, in sum and how many pixels it took
+    __attribute__(( target( "sse2" ) ))
+    int rowDifferenceSse2( const uchar *a, const uchar *b, int width, int &sum )
+    {
+        __m128i sums = _mm_setzero_si128();
+        int x = 0;
+        for( ; x + 16 <= width; x += 16 )
+        {
+            __m128i va = _mm_loadu_si128( ( const __m128i * )( a + x ) );
+            __m128i vb = _mm_loadu_si128( ( const __m128i * )( b + x ) );
+            sums = _mm_add_epi64( sums, _mm_sad_epu8( va, vb ) );
+        }
+
+        // One partial sum per half
+        sum = _mm_cvtsi128_si32( sums ) + _mm_cvtsi128_si32( _mm_srli_si128( sums, 8 ) );
+        return x;
+    }
+
+    typedef int ( *RowKernel )( const uchar *, const uchar *, int, int & );
+
+    RowKernel selectKernel()
+    {
+        __builtin_cpu_init();
+        if( __builtin_cpu_supports( "sse2" ) )
+            return rowDifferenceSse2;
+        return 0;
+    }
+
+#endif
+}
+
+ChangeDetector::ChangeDetector( int scale, int tileSize, int threshold ) : scale( std::max( scale, 1 ) ),
+                                                                         tileSize( std::max( tileSize, 1 ) ),
+                                                                         threshold( threshold ),
+                                                                         tileColumns( 0 ),
+                                                                         tileRows( 0 ),
+                                                                         changedCount( 0 )
+{
+}
+
+int ChangeDetector::compare( const Mat &grayscale )
+{
+    ARUCO_SCOPED_TIMER( "ChangeDetector::compare" );
+
+    CV_Assert( grayscale.type() == CV_8UC1 );
+
+    imageSize = grayscale.size();
+    Size size( std::max( imageSize.width / scale, 1 ), std::max( imageSize.height / scale, 1 ) );
+    resize( grayscale, currentMat, size, 0, 0, INTER_AREA );
+
+    tileColumns = ( size.width + tileSize - 1 ) / tileSize;
+    tileRows = ( size.height + tileSize - 1 ) / tileSize;
+
+    if( referenceMat.size() != size )
+    {
+        changedTiles.assign( tileColumns * tileRows, 1 );
+        changedCount = changedTiles.size();
+        return changedCount;
+    }
+
+#ifdef CHANGE_X86
+    static const RowKernel rowKernel = selectKernel();
+#endif
+
+    tileSums.assign( tileColumns * tileRows, 0 );
+    for( int y = 0; y < size.height; y++ )
+    {
+        const uchar *currentRow = currentMat.ptr< uchar >( y );
+        const uchar *referenceRow = referenceMat.ptr< uchar >( y );
+        int *sums = &tileSums[ ( y / tileSize ) * tileColumns ];
+
+        for( int t = 0; t < tileColumns; t++ )
+        {
+            int from = t * tileSize;
+            int width = std::min( tileSize, size.width - from );
+
+            // The vector kernel leaves the last pixels of the tile to the scalar one
+            int sum = 0, x = 0;
+#ifdef CHANGE_X86
+            if( rowKernel )
+                x = rowKernel( currentRow + from, referenceRow + from, width, sum );
+#endif
+            sums[ t ] += sum + rowDifference( currentRow + from, referenceRow + from, x, width );
+        }
+    }
+
+    changedTiles.resize( tileSums.size() );
+    changedCount = 0;
+    for( int ty = 0; ty < tileRows; ty++ )
+    {
+        for( int t = 0; t < tileColumns; t++ )
+        {
+            int pixels = std::min( tileSize, size.width - t * tileSize ) * std::min( tileSize, size.height - ty * tileSize );
+            int i = ty * tileColumns + t;
+            changedTiles[ i ] = tileSums.at( i ) > threshold * pixels;
+            changedCount += changedTiles[ i ];
+        }
+    }
+
+    return changedCount;
+}
+
+void ChangeDetector::accept()
+{
+    if( referenceMat.size() != currentMat.size() )
+    {
+        acceptAll();
+        return;
+    }
+
+    for( int ty = 0; ty < tileRows; ty++ )
+    {
+        for( int t = 0; t < tileColumns; t++ )
+        {
+            if( !changedTiles.at( ty * tileColumns + t ) )
+                continue;
+
+            Rect tile = Rect( t * tileSize, ty * tileSize, tileSize, tileSize ) & Rect( Point(), currentMat.size() );
+            Mat referenceTile = referenceMat( tile );
+            currentMat( tile ).copyTo( referenceTile );
+        }
+    }
+}
+
+void ChangeDetector::acceptAll()
+{
+    currentMat.copyTo( referenceMat );
+}
+
+int ChangeDetector::getTileCount() const
+{
+    return tileColumns * tileRows;
+}
+
+void ChangeDetector::getChangedTiles( std::vector< Rect > &tiles ) const
+{
+    tiles.clear();
+
+    // The last row and column also take the pixels left out by the downsampling
+    int tilePixels = tileSize * scale;
+    for( int ty = 0; ty < tileRows; ty++ )
+    {
+        for( int t = 0; t < tileColumns; t++ )
+        {
+            if( !changedTiles.at( ty * tileColumns + t ) )
+                continue;
+
+            int right = t + 1 == tileColumns ? imageSize.width : ( t + 1 ) * tilePixels;
+            int bottom = ty + 1 == tileRows ? imageSize.height : ( ty + 1 ) * tilePixels;
+            tiles.push_back( Rect( Point( t * tilePixels, ty * tilePixels ), Point( right, bottom ) ) );
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef CHANGEDETECTOR_HPP
+#define CHANGEDETECTOR_HPP
+
+#include <vector>
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace cv;
+
+// Tells which parts of a frame changed since the frame its markers come from.
+//
+// The grayscale is downsampled, which also averages out the noise of the camera, and
+// split in tiles. A tile changed when the mean of its absolute differences with the
+// reference is over the threshold. The reference is kept per tile: a tile that did not
+// change keeps the frame it was last searched in, so a slow change adds up until the
+// tile is searched again.
+class ChangeDetector
+{
+private:
+
+    int scale;
+    int tileSize;               // Pixels of the downsampled image
+    int threshold;              // Gray levels, mean of a tile
+
+    Mat currentMat;             // Downsampled, of the last frame compared
+    Mat referenceMat;
+    Size imageSize;
+    int tileColumns;
+    int tileRows;
+    std::vector< int > tileSums;
+    std::vector< uchar > changedTiles;
+    int changedCount;
+
+    ChangeDetector( const ChangeDetector & );
+    ChangeDetector &operator=( const ChangeDetector & );
+
+public:
+
+    explicit ChangeDetector( int scale = 4, int tileSize = 16, int threshold = 4 );
+
+    // Compares grayscale with the reference. Returns the number of tiles that changed,
+    // all of them if there is no reference of the same size
+    int compare( const Mat &grayscale );
+
+    // The changed tiles of the last frame compared become the reference
+    void accept();
+
+    // The whole last frame compared becomes the reference
+    void acceptAll();
+
+    int getTileCount() const;
+
+    // Tiles that changed in the last frame compared, in pixels of that frame
+    void getChangedTiles( std::vector< Rect > &tiles ) const;
+};
+
+#endif // CHANGEDETECTOR_HPP
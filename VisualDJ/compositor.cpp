@@ -0,0 +1,177 @@
+#include "compositor.hpp"
+#include "aruco/ar_timers.h"
+
+Compositor::Compositor( int ringSize ) : resolutionRelation( 1 ),
+                                         horizontalDisplacement( 0 ),
+                                         verticalDisplacement( 0 ),
+                                         rotationAngle( 0 ),
+                                         graphicsRing( ringSize ),
+                                         nextGraphics( 0 )
+{
+    for( int i = 0; i < graphicsRing.size(); i++ )
+        graphicsRing[ i ].create( GRAPHICS_HEIGHT, GRAPHICS_WIDTH, CV_8UC3 );
+}
+
+void Compositor::setSounds( const QStringList &names )
+{
+    QMutexLocker locker( &mutex );
+    soundNames = names;
+    soundLevels.fill( 0, names.size() );
+}
+
+void Compositor::setLevels( const QVector< float > &levels )
+{
+    QMutexLocker locker( &mutex );
+    soundLevels = levels;
+}
+
+void Compositor::setCalibration( float resolutionRelation, float horizontalDisplacement, float verticalDisplacement )
+{
+    QMutexLocker locker( &mutex );
+    this->resolutionRelation = resolutionRelation;
+    this->horizontalDisplacement = horizontalDisplacement;
+    this->verticalDisplacement = verticalDisplacement;
+}
+
+void Compositor::process( Frame &frame )
+{
+    ARUCO_SCOPED_TIMER( "Compositor::process" );
+
+    mutex.lock();
+    QStringList names = soundNames;
+    QVector< float > levels = soundLevels;
+    float relation = resolutionRelation;
+    float horizontal = horizontalDisplacement;
+    float vertical = verticalDisplacement;
+    mutex.unlock();
+
+    // Reuses the overlay buffers, the ones still downstream are not touched yet
+    Mat &graphics = graphicsRing[ nextGraphics ];
+    nextGraphics = ( nextGraphics + 1 ) % graphicsRing.size();
+    graphics.setTo( Scalar( 0, 0, 0 ) );
+
+    rotationAngle += 1;
+
+    // Si se detecta el marcador 20, le cambia su id a 4. No se por que.
+    for( int i = 0; i < frame.markers.size(); i++ )
+    {
+        if( frame.markers.at( i ).id == 20 )
+        {
+            frame.markers[ i ].id = 4;
+        }
+    }
+
+    // The GUI thread fades out the sounds of the markers not detected
+    frame.volumes.fill( Frame::NOT_DETECTED, names.size() );
+
+    for( int i = 0; i < frame.markers.size(); i++ )
+    {
+//        int currentMarkerId = frame.markers.at( i ).id - 6;  // No se por que le restaba 6
+        int currentMarkerId = frame.markers.at( i ).id;
+
+        frame.markers.at( i ).draw( graphics, Scalar( 255, 0, 255 ), 1 );
+
+        // Esto dibuja en pequeno sector, el id y el rectangulo de cada marcador detectado
+        Point projectedCenter = frame.markers.at( i ).getCenter();
+        projectedCenter.x *= relation;
+        projectedCenter.x += horizontal;
+        projectedCenter.y *= relation;
+        projectedCenter.y += vertical;
+
+//         drawAura( graphics, projectedCenter );
+
+//        qDebug() << "currentMarkerId" << currentMarkerId << "sounds->size()" << names.size();
+
+        if( currentMarkerId < names.size() )
+        {
+            // A marker below the graphics is detected with no volume, not missing
+            int volume = ( GRAPHICS_HEIGHT - projectedCenter.y ) * 100 / ( float )GRAPHICS_HEIGHT;
+            frame.volumes[ currentMarkerId ] = qBound( 0, volume, 100 );
+
+            float peakValue = currentMarkerId < levels.size() ? levels.at( currentMarkerId ) : 0;
+            drawPeak( graphics, peakValue, projectedCenter );
+
+            QString title = names.at( currentMarkerId );
+            title.remove( ".mp3" );
+            drawTitle( graphics, title, projectedCenter );
+        }
+    }
+
+    frame.graphics = graphics;
+}
+
+void Compositor::drawAura( Mat &graphics, Point center )
+{
+    int lines = 50;
+    int maxRadius = 200;
+
+    for( int i = 0; i <= lines; i++ )
+    {
+        circle( graphics, center, maxRadius / ( float )lines * i, Scalar( 0, 0, 255 ), 1 );
+    }
+
+    float angle = rotationAngle;
+
+    lines = 50;
+    for( int i = 0; i < lines; i++ )
+    {
+        float localAngle = angle * 3.14159264 / ( float )180;
+
+        line( graphics,
+              center,
+              Point( center.x + maxRadius * cos( localAngle ), center.y + maxRadius * sin( localAngle ) ),
+              Scalar( 255, 0, 0 ) );
+
+        angle += 360 / ( float )lines;
+    }
+}
+
+void Compositor::drawTitle( Mat &graphics, QString title, Point center )
+{
+    putText( graphics,
+             title.toStdString().c_str(),
+             Point( center.x - title.length() * 10,
+                    GRAPHICS_HEIGHT - 100 ),
+             FONT_HERSHEY_PLAIN, 2, Scalar( 0, 0, 255 ), 2 );
+}
+
+void Compositor::drawPeak( Mat &graphics, float peakValue, Point markerCenter )
+{
+    float maxLenght = GRAPHICS_HEIGHT - markerCenter.y;
+    float lenght = 2 * peakValue * maxLenght;
+
+    Rect bar( markerCenter.x - 100,
+              GRAPHICS_HEIGHT - lenght,
+              200,
+              lenght );
+
+    Rect bar1 = bar;
+    bar1.x += 5;
+    bar1.width -= 10;
+    bar1.y += 5;
+    bar1.height -= 5;
+
+    Rect bar2 = bar1;
+    bar2.x += 5;
+    bar2.width -= 10;
+    bar2.y += 5;
+    bar2.height -= 5;
+
+    rectangle( graphics, bar, Scalar( 0, 0, 255 ), 5 );
+    rectangle( graphics, bar1, Scalar( 255, 0, 0 ), 5 );
+    rectangle( graphics, bar2, Scalar( 255, 0, 0 ), 5 );
+
+    int radioCirculoInterior = 105;
+
+    // Circulo interior
+    circle( graphics, markerCenter,
+            radioCirculoInterior + lenght / 400, Scalar( 0, 0, 255 ), lenght / 10 );
+
+    // Circulo medio
+    circle( graphics, markerCenter,
+            radioCirculoInterior+25 + lenght / 400, Scalar( 255, 0, 255 ), lenght / 8 );
+
+    // Circulo exterior
+    circle( graphics, markerCenter,
+            radioCirculoInterior+50 + lenght / 500, Scalar( 255, 0, 0 ), lenght / 6 );
+}
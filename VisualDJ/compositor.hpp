@@ -0,0 +1,57 @@
+#ifndef COMPOSITOR_HPP
+#define COMPOSITOR_HPP
+
+//#define GRAPHICS_WIDTH  1920
+//#define GRAPHICS_HEIGHT 1080
+
+#define GRAPHICS_WIDTH  1280
+#define GRAPHICS_HEIGHT 720
+
+#include <QMutex>
+#include <QVector>
+#include <QStringList>
+
+#include <cmath>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "frame.hpp"
+
+using namespace cv;
+
+// Draws the overlay for a frame once its markers are known. Runs on the composite
+// stage, so everything it reads from the GUI thread goes through setters.
+class Compositor
+{
+private:
+
+    QMutex mutex;
+
+    // Written by the GUI thread, protected by mutex
+    QStringList soundNames;
+    QVector< float > soundLevels;
+    float resolutionRelation;
+    float horizontalDisplacement;
+    float verticalDisplacement;
+
+    // Only used by the composite stage
+    float rotationAngle;
+    QVector< Mat > graphicsRing;
+    int nextGraphics;
+
+    void drawAura( Mat &graphics, Point center );
+    void drawTitle( Mat &graphics, QString title, Point center );
+    void drawPeak( Mat &graphics, float peakValue, Point markerCenter );
+
+public:
+
+    // ringSize must cover every overlay that can be alive downstream at the same time
+    explicit Compositor( int ringSize );
+
+    void setSounds( const QStringList &names );
+    void setLevels( const QVector< float > &levels );
+    void setCalibration( float resolutionRelation, float horizontalDisplacement, float verticalDisplacement );
+
+    void process( Frame &frame );
+};
+
+#endif // COMPOSITOR_HPP
@@ -0,0 +1,27 @@
+#include "frame.hpp"
+#include <QElapsedTimer>
+
+namespace
+{
+    struct FrameClock
+    {
+        QElapsedTimer timer;
+        FrameClock() { timer.start(); }
+    };
+
+    FrameClock frameClock;
+}
+
+Frame::Frame() : id( 0 ),
+                 capturedAt( 0 ),
+                 detectedAt( 0 ),
+                 compositedAt( 0 ),
+                 volumesAppliedAt( 0 ),
+                 presentedAt( 0 )
+{
+}
+
+qint64 Frame::now()
+{
+    return frameClock.timer.nsecsElapsed();
+}
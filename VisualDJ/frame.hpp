@@ -0,0 +1,37 @@
+#ifndef FRAME_HPP
+#define FRAME_HPP
+
+#include <QVector>
+#include <opencv2/core/core.hpp>
+
+#include "aruco/aruco.h"
+
+using namespace cv;
+using namespace aruco;
+
+// Unit of work that travels through the pipeline stages.
+// Timestamps are in nanoseconds from Frame::now().
+struct Frame
+{
+    quint64 id;
+
+    qint64 capturedAt;
+    qint64 detectedAt;
+    qint64 compositedAt;
+    qint64 volumesAppliedAt;    // Set by the render stage
+    qint64 presentedAt;
+
+    Mat image;                  // Camera frame, only valid in the detection stage
+    Mat graphics;               // Overlay drawn by the compositor
+    QVector< Marker > markers;
+    QVector< int > volumes;     // Volume per sound in [0,100], NOT_DETECTED if its marker was not detected
+
+    // Out of the range of the volumes, so no volume is taken as a missing marker
+    static const int NOT_DETECTED = -1;
+
+    Frame();
+
+    static qint64 now();
+};
+
+#endif // FRAME_HPP
@@ -0,0 +1,381 @@
+#include "framedetector.hpp"
+#include "binarize.hpp"
+#include "aruco/ar_timers.h"
+
+#include <algorithm>
+
+#define RESCAN_INTERVAL 10      // Frames
+#define MARKER_SIZE     0.08f   // Meters
+#define REGION_MARGIN   0.5     // Of the marker side, for each frame since it was seen
+#define TILE_MARGIN     16      // Pixels, around a changed tile, for markers that barely reach the next one
+#define MAX_CHANGED     0.5     // Of the tiles, with more the whole frame is searched
+
+namespace
+{
+    // Into a marker that already has its buffers, so they are reused. A Marker copy allocates
+    // the pose matrices, and an assignment shares them with the source
+    void copyMarker( const Marker &from, Marker &to )
+    {
+        static_cast< std::vector< Point2f > & >( to ) = from;
+        to.id = from.id;
+        to.ssize = from.ssize;
+        from.Rvec.copyTo( to.Rvec );
+        from.Tvec.copyTo( to.Tvec );
+    }
+
+    // Only allocates when there are more markers than the last time
+    template< typename Markers >
+    void copyMarkers( const std::vector< Marker > &from, Markers &to )
+    {
+        to.resize( from.size() );
+        for( size_t i = 0; i < from.size(); i++ )
+            copyMarker( from[ i ], to[ ( int )i ] );
+    }
+
+    // After the first count markers, which becomes one more
+    void appendMarker( std::vector< Marker > &markers, size_t &count, const Marker &marker )
+    {
+        if( count < markers.size() )
+            copyMarker( marker, markers[ count ] );
+        else
+            markers.push_back( marker );
+        count++;
+    }
+
+    // By id. std::sort would copy the markers, a Marker has no move
+    void sortMarkers( std::vector< Marker > &markers )
+    {
+        for( size_t i = 1; i < markers.size(); i++ )
+        {
+            for( size_t j = i; j > 0 && markers[ j ].id < markers[ j - 1 ].id; j-- )
+            {
+                Marker &a = markers[ j ], &b = markers[ j - 1 ];
+                static_cast< std::vector< Point2f > & >( a ).swap( b );
+                std::swap( a.id, b.id );
+                std::swap( a.ssize, b.ssize );
+                cv::swap( a.Rvec, b.Rvec );
+                cv::swap( a.Tvec, b.Tvec );
+            }
+        }
+    }
+}
+
+FrameDetector::FrameDetector( const CameraParameters &cameraParameters ) : cameraParameters( new CameraParameters( cameraParameters ) ),
+                                                                           markerDetector( new MarkerDetector ),
+                                                                           pyrDownLevel( 0 ),
+                                                                           rescanInterval( RESCAN_INTERVAL ),
+                                                                           lastFrameId( 0 ),
+                                                                           lastFullScanId( 0 ),
+                                                                           markerTracker( new MarkerTracker ),
+                                                                           opticalFlow( true ),
+                                                                           changeDetector( new ChangeDetector ),
+                                                                           changeDetection( true ),
+                                                                           searchedAll( false )
+{
+}
+
+FrameDetector::~FrameDetector()
+{
+    delete changeDetector;
+    delete markerTracker;
+    delete markerDetector;
+    delete cameraParameters;
+}
+
+void FrameDetector::process( Frame &frame )
+{
+    ARUCO_SCOPED_TIMER( "FrameDetector::process" );
+
+    // One pass for both, the detector does not convert nor threshold again. The whole frame and
+    // its regions use the same level
+    pyrDownLevel = markerDetector->nextPyrDownLevel();
+    binarize( frame.image, grayscaleMat, pyramidMats, binaryMat, pyrDownLevel, 128 );
+    cameraParameters->resize( grayscaleMat.size() );
+
+    // The detector may be called once per region, its identity cache counts frames
+    markerDetector->beginFrame();
+
+    // With several detectors a detector only sees every n-th frame, the markers moved
+    // for all the frames in between
+    quint64 framesSinceLast = frame.id > lastFrameId ? frame.id - lastFrameId : 1;
+
+    // What did not change since the whole frame was searched has the same markers
+    int changed = changeDetection ? changeDetector->compare( grayscaleMat ) : -1;
+    bool partial = searchedAll && changed >= 0 && changed <= changeDetector->getTileCount() * MAX_CHANGED;
+
+    bool tracked = false;
+    if( partial )
+    {
+        if( changed > 0 )
+            detectInChangedTiles( framesSinceLast );
+        changeDetector->accept();
+    }
+    else
+    {
+        bool fullScan = trackedMarkers.empty() || rescanInterval <= 1 ||
+                        frame.id < lastFullScanId || frame.id - lastFullScanId >= ( quint64 )rescanInterval;
+
+        tracked = !fullScan && opticalFlow && trackMarkers();
+        if( !fullScan && !tracked && !detectInRegions( framesSinceLast ) )
+            fullScan = true;
+
+        if( fullScan )
+        {
+            detectFullFrame();
+            lastFullScanId = frame.id;
+        }
+
+        // Tracking and regions only look around the markers, new ones wait for the next full scan
+        searchedAll = fullScan;
+        if( changeDetection )
+            changeDetector->acceptAll();
+    }
+
+    // The tracker goes on from the markers just detected. If nothing changed it has them already
+    if( opticalFlow && !tracked && !( partial && changed == 0 ) )
+        markerTracker->reset( grayscaleMat, detectedMarkersVector );
+
+    lastFrameId = frame.id;
+    copyMarkers( detectedMarkersVector, trackedMarkers );
+    copyMarkers( detectedMarkersVector, frame.markers );
+}
+
+void FrameDetector::detectFullFrame()
+{
+    ARUCO_SCOPED_TIMER( "FrameDetector::detectFullFrame" );
+
+    // Not cleared, the detector reuses the markers it already has
+    markerDetector->detectThresholded( grayscaleMat, binaryMat, pyrDownLevel, detectedMarkersVector, *cameraParameters, MARKER_SIZE );
+}
+
+bool FrameDetector::trackMarkers()
+{
+    ARUCO_SCOPED_TIMER( "FrameDetector::trackMarkers" );
+
+    if( !markerTracker->track( grayscaleMat, detectedMarkersVector ) )
+        return false;
+
+    if( cameraParameters->isValid() )
+    {
+        for( size_t i = 0; i < detectedMarkersVector.size(); i++ )
+            detectedMarkersVector[ i ].calculateExtrinsics( MARKER_SIZE, *cameraParameters );
+    }
+
+    return true;
+}
+
+void FrameDetector::detectInChangedTiles( quint64 framesSinceLast )
+{
+    ARUCO_SCOPED_TIMER( "FrameDetector::detectInChangedTiles" );
+
+    computeChangedRegions( framesSinceLast );
+
+    // The markers away from the changes are still where they were, with the same pose
+    size_t kept = 0;
+    for( size_t i = 0; i < trackedMarkers.size(); i++ )
+    {
+        Rect box = markerRegion( trackedMarkers.at( i ), framesSinceLast );
+        bool changed = false;
+        for( size_t r = 0; r < regions.size() && !changed; r++ )
+            changed = ( box & regions.at( r ) ).area() > 0;
+
+        if( !changed )
+            appendMarker( detectedMarkersVector, kept, trackedMarkers.at( i ) );
+    }
+
+    detectRegions( kept );
+
+    if( cameraParameters->isValid() )
+    {
+        for( size_t i = kept; i < detectedMarkersVector.size(); i++ )
+            detectedMarkersVector[ i ].calculateExtrinsics( MARKER_SIZE, *cameraParameters );
+    }
+    sortMarkers( detectedMarkersVector );
+}
+
+void FrameDetector::computeRegions( quint64 framesSinceLast )
+{
+    regions.clear();
+
+    for( size_t i = 0; i < trackedMarkers.size(); i++ )
+        addRegion( markerRegion( trackedMarkers.at( i ), framesSinceLast ) );
+}
+
+Rect FrameDetector::markerRegion( const Marker &marker, quint64 framesSinceLast ) const
+{
+    // Room for the marker to move, and for its corners to stay out of the border the detector ignores
+    Rect box = boundingRect( marker );
+    int margin = REGION_MARGIN * std::max( box.width, box.height ) * framesSinceLast;
+    return Rect( box.x - margin, box.y - margin, box.width + 2 * margin, box.height + 2 * margin ) &
+           Rect( 0, 0, grayscaleMat.cols, grayscaleMat.rows );
+}
+
+void FrameDetector::computeChangedRegions( quint64 framesSinceLast )
+{
+    Rect image( 0, 0, grayscaleMat.cols, grayscaleMat.rows );
+    regions.clear();
+
+    // With the margin, neighbour tiles overlap and share a region
+    changeDetector->getChangedTiles( changedTiles );
+    for( size_t i = 0; i < changedTiles.size(); i++ )
+    {
+        const Rect &tile = changedTiles.at( i );
+        addRegion( Rect( tile.x - TILE_MARGIN, tile.y - TILE_MARGIN,
+                         tile.width + 2 * TILE_MARGIN, tile.height + 2 * TILE_MARGIN ) & image );
+    }
+
+    // A marker partly in a region is searched whole, with the margin it may have moved
+    // by. Growing a region may reach another marker
+    for( bool grown = true; grown; )
+    {
+        grown = false;
+        for( size_t i = 0; i < trackedMarkers.size(); i++ )
+        {
+            Rect box = markerRegion( trackedMarkers.at( i ), framesSinceLast );
+            for( size_t r = 0; r < regions.size(); r++ )
+            {
+                Rect overlap = box & regions.at( r );
+                if( overlap.area() > 0 && overlap != box )
+                {
+                    addRegion( box );
+                    grown = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void FrameDetector::addRegion( Rect box )
+{
+    // Regions that overlap are merged, so no marker is found twice
+    for( size_t j = 0; j < regions.size(); )
+    {
+        if( ( box & regions.at( j ) ).area() > 0 )
+        {
+            box |= regions.at( j );
+            regions.erase( regions.begin() + j );
+            j = 0;
+        }
+        else
+            j++;
+    }
+
+    if( box.area() > 0 )
+        regions.push_back( box );
+}
+
+void FrameDetector::detectRegions( size_t kept )
+{
+    size_t count = kept;
+
+    float minSize, maxSize;
+    markerDetector->getMinMaxSize( minSize, maxSize );
+    int imageSide = std::max( grayscaleMat.cols, grayscaleMat.rows );
+
+    // A region of the reduced binary image starts at a multiple of the reduction in the full one
+    int reduction = 1 << pyrDownLevel;
+    Rect reducedImage( 0, 0, binaryMat.cols, binaryMat.rows );
+
+    for( size_t r = 0; r < regions.size(); r++ )
+    {
+        Rect region = regions.at( r );
+        int x = region.x / reduction * reduction;
+        int y = region.y / reduction * reduction;
+        region = Rect( x, y, region.x + region.width - x, region.y + region.height - y );
+        Rect reducedRegion = Rect( x / reduction, y / reduction,
+                                   ( region.width + reduction - 1 ) / reduction,
+                                   ( region.height + reduction - 1 ) / reduction ) & reducedImage;
+
+        // The detector limits the marker size relative to the image it gets, the region is smaller
+        float scale = imageSide / ( float )std::max( region.width, region.height );
+        markerDetector->setMinMaxSize( std::min( 1.0f, minSize * scale ), std::min( 1.0f, maxSize * scale ) );
+
+        // No camera parameters, the caller computes the pose with the corners in the whole frame
+        markerDetector->detectThresholded( grayscaleMat( region ), binaryMat( reducedRegion ), pyrDownLevel,
+                                           regionMarkersVector, CameraParameters() );
+
+        for( size_t i = 0; i < regionMarkersVector.size(); i++ )
+        {
+            Marker &marker = regionMarkersVector[ i ];
+            for( size_t c = 0; c < marker.size(); c++ )
+            {
+                marker[ c ].x += region.x;
+                marker[ c ].y += region.y;
+            }
+            appendMarker( detectedMarkersVector, count, marker );
+        }
+    }
+    detectedMarkersVector.resize( count );
+    markerDetector->setMinMaxSize( minSize, maxSize );
+}
+
+bool FrameDetector::detectInRegions( quint64 framesSinceLast )
+{
+    ARUCO_SCOPED_TIMER( "FrameDetector::detectInRegions" );
+
+    computeRegions( framesSinceLast );
+
+    detectRegions( 0 );
+
+    // A marker that moved out of its region may be anywhere, the caller searches the whole frame
+    for( size_t i = 0; i < trackedMarkers.size(); i++ )
+    {
+        bool found = false;
+        for( size_t j = 0; j < detectedMarkersVector.size() && !found; j++ )
+            found = detectedMarkersVector.at( j ).id == trackedMarkers.at( i ).id;
+
+        if( !found )
+            return false;
+    }
+
+    sortMarkers( detectedMarkersVector );
+    if( cameraParameters->isValid() )
+    {
+        for( size_t i = 0; i < detectedMarkersVector.size(); i++ )
+            detectedMarkersVector[ i ].calculateExtrinsics( MARKER_SIZE, *cameraParameters );
+    }
+
+    return true;
+}
+
+MarkerDetector *FrameDetector::getMarkerDetector() const
+{
+    return markerDetector;
+}
+
+void FrameDetector::setRescanInterval( int frames )
+{
+    rescanInterval = frames;
+}
+
+int FrameDetector::getRescanInterval() const
+{
+    return rescanInterval;
+}
+
+void FrameDetector::setOpticalFlow( bool enabled )
+{
+    opticalFlow = enabled;
+}
+
+bool FrameDetector::getOpticalFlow() const
+{
+    return opticalFlow;
+}
+
+void FrameDetector::setChangeDetection( bool enabled )
+{
+    changeDetection = enabled;
+    searchedAll = false;
+}
+
+bool FrameDetector::getChangeDetection() const
+{
+    return changeDetection;
+}
+
+void FrameDetector::setAutoReduction( int minMarkerPixels )
+{
+    markerDetector->setAutoPyrDown( qMax( 0, minMarkerPixels ) );
+}
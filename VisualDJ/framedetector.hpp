@@ -0,0 +1,96 @@
+#ifndef FRAMEDETECTOR_HPP
+#define FRAMEDETECTOR_HPP
+
+#include <vector>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "aruco/aruco.h"
+#include "frame.hpp"
+#include "markertracker.hpp"
+#include "changedetector.hpp"
+
+using namespace cv;
+using namespace aruco;
+
+// Finds the markers of a camera frame. Keeps its own detector, camera parameters
+// and buffers, so one instance must only be used by one thread at a time.
+//
+// Once markers are found, their corners are followed with optical flow in the next
+// frames, and if that fails they are searched around their last position. The whole
+// frame is searched again every few frames, for new markers, and as soon as a tracked
+// marker is lost.
+//
+// After a search of the whole frame, the tiles of the image that did not change keep
+// their markers and only the ones that changed are searched again. A still scene is
+// not searched at all until something moves.
+class FrameDetector
+{
+private:
+
+    CameraParameters *cameraParameters;
+    MarkerDetector *markerDetector;
+
+    Mat grayscaleMat;
+    Mat binaryMat;              // 255 where the image is dark, reduced pyrDownLevel times
+    std::vector< Mat > pyramidMats;
+    int pyrDownLevel;
+    std::vector< Marker > detectedMarkersVector;
+
+    // Tracking
+    int rescanInterval;
+    quint64 lastFrameId;
+    quint64 lastFullScanId;
+    std::vector< Marker > trackedMarkers;
+    std::vector< Marker > regionMarkersVector;
+    std::vector< Rect > regions;
+    MarkerTracker *markerTracker;
+    bool opticalFlow;
+
+    // Change detection
+    ChangeDetector *changeDetector;
+    bool changeDetection;
+    bool searchedAll;           // Every tile was searched since it last changed
+    std::vector< Rect > changedTiles;
+
+    void detectFullFrame();
+    bool trackMarkers();
+    bool detectInRegions( quint64 framesSinceLast );
+    void detectInChangedTiles( quint64 framesSinceLast );
+    void computeRegions( quint64 framesSinceLast );
+    void computeChangedRegions( quint64 framesSinceLast );
+    Rect markerRegion( const Marker &marker, quint64 framesSinceLast ) const;
+    void addRegion( Rect box );
+    // Appends the markers of the regions after the first kept markers
+    void detectRegions( size_t kept );
+
+    FrameDetector( const FrameDetector & );
+    FrameDetector &operator=( const FrameDetector & );
+
+public:
+
+    explicit FrameDetector( const CameraParameters &cameraParameters );
+    ~FrameDetector();
+
+    // Fills frame.markers from frame.image
+    void process( Frame &frame );
+
+    MarkerDetector *getMarkerDetector() const;
+
+    // Frames between two searches of the whole frame. 1 searches every frame whole
+    void setRescanInterval( int frames );
+    int getRescanInterval() const;
+
+    // Follows the markers with optical flow between searches. On by default
+    void setOpticalFlow( bool enabled );
+    bool getOpticalFlow() const;
+
+    // Searches only the tiles that changed since the last search. On by default
+    void setChangeDetection( bool enabled );
+    bool getChangeDetection() const;
+
+    // Thresholds and traces the contours in a reduced image, as small as the smallest marker
+    // found in the last frames keeps minMarkerPixels per side. 0, the default, is full resolution
+    void setAutoReduction( int minMarkerPixels );
+};
+
+#endif // FRAMEDETECTOR_HPP
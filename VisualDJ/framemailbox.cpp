@@ -0,0 +1,106 @@
+#include "framemailbox.hpp"
+
+FrameMailbox::FrameMailbox() : backIndex( 0 ),
+                               frontIndex( 1 ),
+                               middleIndex( 2 ),
+                               droppedFrames( 0 ),
+                               staleReads( 0 ),
+                               readerWaiting( 0 ),
+                               writerWaiting( 0 )
+{
+}
+
+Frame &FrameMailbox::writeBuffer()
+{
+    return buffers[ backIndex ];
+}
+
+void FrameMailbox::publish()
+{
+    // Hands the written slot to the reader and takes back the one it was not using
+    int previous = middleIndex.fetchAndStoreOrdered( backIndex | FRESH_FRAME );
+    backIndex = previous & INDEX_MASK;
+
+    if( previous & FRESH_FRAME )
+        droppedFrames.fetchAndAddRelaxed( 1 );
+
+    // Read with an exchange, ordered with the one of the reader on the same flag: either the reader
+    // sees the fresh frame or this sees it waiting. Taking the mutex guarantees a reader that just
+    // saw no fresh frame is already waiting
+    if( readerWaiting.fetchAndAddOrdered( 0 ) )
+    {
+        waitMutex.lock();
+        waitMutex.unlock();
+        frameArrived.wakeOne();
+    }
+}
+
+bool FrameMailbox::waitUntilTaken( unsigned long timeoutMs )
+{
+    if( !( middleIndex.load() & FRESH_FRAME ) )
+        return true;
+
+    writerWaiting.fetchAndStoreOrdered( 1 );
+    waitMutex.lock();
+    if( middleIndex.load() & FRESH_FRAME )
+        frameTaken.wait( &waitMutex, timeoutMs );
+    waitMutex.unlock();
+    writerWaiting.fetchAndStoreOrdered( 0 );
+
+    return !( middleIndex.load() & FRESH_FRAME );
+}
+
+bool FrameMailbox::tryRead( Frame &frame )
+{
+    if( !( middleIndex.load() & FRESH_FRAME ) )
+        return false;
+
+    int previous = middleIndex.fetchAndStoreOrdered( frontIndex );
+    frontIndex = previous & INDEX_MASK;
+
+    frame = buffers[ frontIndex ];
+
+    // Same as publish()
+    if( writerWaiting.fetchAndAddOrdered( 0 ) )
+    {
+        waitMutex.lock();
+        waitMutex.unlock();
+        frameTaken.wakeOne();
+    }
+
+    return true;
+}
+
+bool FrameMailbox::read( Frame &frame )
+{
+    if( tryRead( frame ) )
+        return true;
+
+    staleReads.fetchAndAddRelaxed( 1 );
+    return false;
+}
+
+bool FrameMailbox::waitForFrame( Frame &frame, unsigned long timeoutMs )
+{
+    if( tryRead( frame ) )
+        return true;
+
+    readerWaiting.fetchAndStoreOrdered( 1 );
+    waitMutex.lock();
+    if( !( middleIndex.load() & FRESH_FRAME ) )
+        frameArrived.wait( &waitMutex, timeoutMs );
+    waitMutex.unlock();
+    readerWaiting.fetchAndStoreOrdered( 0 );
+
+    return tryRead( frame );
+}
+
+int FrameMailbox::getDroppedFrames() const
+{
+    return droppedFrames.load();
+}
+
+int FrameMailbox::getStaleReads() const
+{
+    return staleReads.load();
+}
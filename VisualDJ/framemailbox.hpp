@@ -0,0 +1,56 @@
+#ifndef FRAMEMAILBOX_HPP
+#define FRAMEMAILBOX_HPP
+
+#include <QMutex>
+#include <QAtomicInt>
+#include <QWaitCondition>
+
+#include "frame.hpp"
+
+// Triple buffer between one writer (the capture thread) and one reader (the scene).
+// The writer never waits and the reader always gets the newest frame: a frame that
+// is not read before the next one is published is dropped. A lossless writer calls
+// waitUntilTaken() before publishing, so nothing is dropped.
+// Publishing and reading are lock free. The mutex is only taken to wake the other
+// side when it is sleeping in waitForFrame() or waitUntilTaken().
+class FrameMailbox
+{
+private:
+
+    enum { FRESH_FRAME = 4, INDEX_MASK = 3 };
+
+    Frame buffers[ 3 ];
+
+    int backIndex;              // Slot being written, owned by the writer
+    int frontIndex;             // Slot being read, owned by the reader
+    QAtomicInt middleIndex;     // Slot exchanged between both, plus FRESH_FRAME
+
+    QAtomicInt droppedFrames;   // Published frames that were never read
+    QAtomicInt staleReads;      // Reads that found no new frame
+
+    QMutex waitMutex;           // Only used to sleep in waitForFrame() and waitUntilTaken()
+    QWaitCondition frameArrived;
+    QWaitCondition frameTaken;
+    QAtomicInt readerWaiting;   // Set before the reader checks for a frame and sleeps
+    QAtomicInt writerWaiting;   // Same for the writer
+
+    bool tryRead( Frame &frame );
+
+public:
+
+    FrameMailbox();
+
+    // Writer side
+    Frame &writeBuffer();
+    void publish();
+    bool waitUntilTaken( unsigned long timeoutMs );
+
+    // Reader side. The frame image stays valid until the next read
+    bool read( Frame &frame );
+    bool waitForFrame( Frame &frame, unsigned long timeoutMs );
+
+    int getDroppedFrames() const;
+    int getStaleReads() const;
+};
+
+#endif // FRAMEMAILBOX_HPP
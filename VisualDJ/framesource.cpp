@@ -0,0 +1,160 @@
+#include "framesource.hpp"
+
+FrameSource::FrameSource() : realTime( true )
+{
+}
+
+FrameSource::~FrameSource()
+{
+}
+
+bool FrameSource::isRealTime() const
+{
+    return realTime || isLive();
+}
+
+void FrameSource::setRealTime( bool value )
+{
+    realTime = value;
+}
+
+bool FrameSource::isLossless() const
+{
+    return !isRealTime();
+}
+
+
+CameraSource::CameraSource( int device ) : videoCapture( new VideoCapture( device ) ),
+                                           device( device )
+{
+}
+
+CameraSource::~CameraSource()
+{
+    delete videoCapture;
+}
+
+bool CameraSource::read( Mat &image )
+{
+    return videoCapture->read( image );
+}
+
+bool CameraSource::isOpened() const
+{
+    return videoCapture->isOpened();
+}
+
+bool CameraSource::isLive() const
+{
+    return true;
+}
+
+bool CameraSource::atEnd() const
+{
+    // A camera never ends, a failed read is retried
+    return false;
+}
+
+double CameraSource::getFps() const
+{
+    return videoCapture->get( CV_CAP_PROP_FPS );
+}
+
+QString CameraSource::getDescription() const
+{
+    return "camera " + QString::number( device );
+}
+
+
+VideoFileSource::VideoFileSource( QString fileName ) : videoCapture( new VideoCapture( fileName.toStdString() ) ),
+                                                       fileName( fileName ),
+                                                       ended( false )
+{
+}
+
+VideoFileSource::~VideoFileSource()
+{
+    delete videoCapture;
+}
+
+bool VideoFileSource::read( Mat &image )
+{
+    if( !videoCapture->read( image ) )
+        ended = true;
+
+    return !ended;
+}
+
+bool VideoFileSource::isOpened() const
+{
+    return videoCapture->isOpened();
+}
+
+bool VideoFileSource::isLive() const
+{
+    return false;
+}
+
+bool VideoFileSource::atEnd() const
+{
+    return ended;
+}
+
+double VideoFileSource::getFps() const
+{
+    double fps = videoCapture->get( CV_CAP_PROP_FPS );
+    return fps > 0 ? fps : 30;
+}
+
+QString VideoFileSource::getDescription() const
+{
+    return "video " + fileName;
+}
+
+
+ImageDirectorySource::ImageDirectorySource( QString path, double fps ) : directory( path ),
+                                                                          nextImage( 0 ),
+                                                                          fps( fps > 0 ? fps : 30 )
+{
+    QStringList fileFilter;
+    fileFilter << "*.jpg" << "*.png" << "*.bmp";
+    imageFiles = directory.entryList( fileFilter, QDir::Files, QDir::Name );
+}
+
+bool ImageDirectorySource::read( Mat &image )
+{
+    while( nextImage < imageFiles.size() )
+    {
+        image = imread( directory.filePath( imageFiles.at( nextImage++ ) ).toStdString() );
+
+        if( !image.empty() )
+            return true;
+    }
+
+    return false;
+}
+
+bool ImageDirectorySource::isOpened() const
+{
+    return !imageFiles.isEmpty();
+}
+
+bool ImageDirectorySource::isLive() const
+{
+    return false;
+}
+
+bool ImageDirectorySource::atEnd() const
+{
+    return nextImage >= imageFiles.size();
+}
+
+double ImageDirectorySource::getFps() const
+{
+    return fps;
+}
+
+QString ImageDirectorySource::getDescription() const
+{
+    return "images " + directory.path() + " (" + QString::number( imageFiles.size() ) + " files)";
+}
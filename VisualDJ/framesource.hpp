@@ -0,0 +1,102 @@
+#ifndef FRAMESOURCE_HPP
+#define FRAMESOURCE_HPP
+
+#include <QDir>
+#include <QString>
+#include <QStringList>
+
+#include <opencv2/highgui/highgui.hpp>
+
+using namespace cv;
+
+// Where the frames come from. A recorded source can be played in real time, paced
+// and dropping frames like a camera, or as fast as possible without losing any frame
+// so every run over the same recording gives the same results.
+class FrameSource
+{
+private:
+
+    bool realTime;
+
+public:
+
+    FrameSource();
+    virtual ~FrameSource();
+
+    virtual bool read( Mat &image ) = 0;
+    virtual bool isOpened() const = 0;
+    virtual bool isLive() const = 0;
+    virtual bool atEnd() const = 0;
+    virtual double getFps() const = 0;
+    virtual QString getDescription() const = 0;
+
+    bool isRealTime() const;
+    void setRealTime( bool value );
+
+    // Frames can not be dropped, the capture waits for the pipeline instead
+    bool isLossless() const;
+};
+
+class CameraSource : public FrameSource
+{
+private:
+
+    VideoCapture *videoCapture;
+    int device;
+
+public:
+
+    explicit CameraSource( int device );
+    ~CameraSource();
+
+    bool read( Mat &image );
+    bool isOpened() const;
+    bool isLive() const;
+    bool atEnd() const;
+    double getFps() const;
+    QString getDescription() const;
+};
+
+class VideoFileSource : public FrameSource
+{
+private:
+
+    VideoCapture *videoCapture;
+    QString fileName;
+    bool ended;
+
+public:
+
+    explicit VideoFileSource( QString fileName );
+    ~VideoFileSource();
+
+    bool read( Mat &image );
+    bool isOpened() const;
+    bool isLive() const;
+    bool atEnd() const;
+    double getFps() const;
+    QString getDescription() const;
+};
+
+class ImageDirectorySource : public FrameSource
+{
+private:
+
+    QDir directory;
+    QStringList imageFiles;
+    int nextImage;
+    double fps;
+
+public:
+
+    ImageDirectorySource( QString path, double fps );
+
+    bool read( Mat &image );
+    bool isOpened() const;
+    bool isLive() const;
+    bool atEnd() const;
+    double getFps() const;
+    QString getDescription() const;
+};
+
+#endif // FRAMESOURCE_HPP
@@ -0,0 +1,43 @@
+#include "latencyrecord.hpp"
+
+LatencyRecord::LatencyRecord( QString name ) : name( name )
+{
+}
+
+void LatencyRecord::append( qint64 latency )
+{
+    // A clock that went back is counted as no latency
+    histogram.add( latency > 0 ? latency : 0 );
+}
+
+void LatencyRecord::clear()
+{
+    histogram.reset();
+}
+
+int LatencyRecord::count() const
+{
+    return histogram.count();
+}
+
+void LatencyRecord::print( QTextStream &out ) const
+{
+    if( histogram.count() == 0 )
+        return;
+
+    out << qSetFieldWidth( 12 ) << left << name << qSetFieldWidth( 0 )
+        << " p50 " << QString::number( histogram.percentile( 50 ) / 1e6, 'f', 2 ) << " ms"
+        << "  p95 " << QString::number( histogram.percentile( 95 ) / 1e6, 'f', 2 ) << " ms"
+        << "  p99 " << QString::number( histogram.percentile( 99 ) / 1e6, 'f', 2 ) << " ms"
+        << "  max " << QString::number( histogram.max() / 1e6, 'f', 2 ) << " ms"
+        << "  (" << count() << " frames)\n";
+}
+
+QString LatencyRecord::toString() const
+{
+    QString text;
+    QTextStream out( &text );
+    print( out );
+    out.flush();
+    return text;
+}
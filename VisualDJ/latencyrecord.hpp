@@ -0,0 +1,35 @@
+#ifndef LATENCYRECORD_HPP
+#define LATENCYRECORD_HPP
+
+#include <QString>
+#include <QTextStream>
+
+#include "aruco/ar_timers.h"
+
+// Latencies of one stage, in nanoseconds. The samples go to a fixed size histogram, so a
+// whole show takes the same memory as one frame and any thread can append. The
+// percentiles have the error of its buckets, about 20%, the max is exact
+class LatencyRecord
+{
+private:
+
+    QString name;
+    aruco::TimingHistogram histogram;
+
+    LatencyRecord( const LatencyRecord & );
+    LatencyRecord &operator=( const LatencyRecord & );
+
+public:
+
+    explicit LatencyRecord( QString name );
+
+    void append( qint64 latency );
+    void clear();
+    int count() const;
+
+    // One line with p50, p95, p99 and max in milliseconds. Nothing if there are no samples
+    void print( QTextStream &out ) const;
+    QString toString() const;
+};
+
+#endif // LATENCYRECORD_HPP
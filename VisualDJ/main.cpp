@@ -1,15 +1,97 @@
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QDebug>
 #include "scene.hpp"
+#include "framesource.hpp"
+#include "aruco/ar_timers.h"
+#include "aruco/ar_threadpool.h"
 
 int main( int argc, char **argv )
 {
     QApplication application( argc, argv );
 
-    Scene scene;
+    QCommandLineParser parser;
+    parser.setApplicationDescription( "Visual DJ" );
+    parser.addHelpOption();
+
+    QCommandLineOption cameraOption( "camera", "Camera device (default 1).", "device", "1" );
+    QCommandLineOption videoOption( "video", "Play a video file instead of the camera.", "file" );
+    QCommandLineOption imagesOption( "images", "Play a directory of images instead of the camera.", "directory" );
+    QCommandLineOption fpsOption( "fps", "Frame rate of the images directory (default 30).", "fps", "30" );
+    QCommandLineOption fastOption( "fast", "Play the video or images as fast as possible without dropping frames, "
+                                           "and quit at the end." );
+    QCommandLineOption detectionThreadsOption( "detection-threads", "Frames detected at the same time (default 1). "
+                                               "Each detector then sees every Nth frame only, so tracking, optical "
+                                               "flow and change detection work on frames N apart.", "count", "1" );
+    QCommandLineOption reduceOption( "reduce-resolution", "Look for the markers in a reduced image, as small as the "
+                                                          "smallest marker keeps this many pixels per side, for "
+                                                          "1080p cameras (default 0, full resolution).", "pixels", "0" );
+    QCommandLineOption visionCoresOption( "vision-cores", "Cores for marker detection, comma separated, like 2,3,4,5. "
+                                                          "The other cores are left for audio (default all).", "cores" );
+    QCommandLineOption latencyOption( "measure-latency", "Measure the latency from the capture of a frame to its volumes "
+                                                         "and to the screen, and print it at exit or with T." );
+    QCommandLineOption traceOption( "trace", "Record a timeline of the processing stages on every thread "
+                                             "and write it to file, for chrome://tracing or Perfetto.", "file" );
+
+    parser.addOption( cameraOption );
+    parser.addOption( videoOption );
+    parser.addOption( imagesOption );
+    parser.addOption( fpsOption );
+    parser.addOption( fastOption );
+    parser.addOption( detectionThreadsOption );
+    parser.addOption( reduceOption );
+    parser.addOption( visionCoresOption );
+    parser.addOption( latencyOption );
+    parser.addOption( traceOption );
+    parser.process( application );
+
+    FrameSource *frameSource;
+    if( parser.isSet( videoOption ) )
+        frameSource = new VideoFileSource( parser.value( videoOption ) );
+    else if( parser.isSet( imagesOption ) )
+        frameSource = new ImageDirectorySource( parser.value( imagesOption ), parser.value( fpsOption ).toDouble() );
+    else
+        frameSource = new CameraSource( parser.value( cameraOption ).toInt() );
+
+    if( !frameSource->isOpened() )
+        qDebug() << "Could not open" << frameSource->getDescription();
+
+    frameSource->setRealTime( !parser.isSet( fastOption ) );
+
+    // One detector sees every frame. With more, consecutive frames go to different detectors,
+    // and each one follows the markers over frames N apart
+    int detectionThreads = qMax( 1, parser.value( detectionThreadsOption ).toInt() );
+
+    // Before the first detection, the detectors create the pool when they first use it
+    if( parser.isSet( visionCoresOption ) )
+    {
+        QStringList coreList = parser.value( visionCoresOption ).split( ',', QString::SkipEmptyParts );
+        std::vector< int > cores;
+        for( int i = 0; i < coreList.size(); i++ )
+            cores.push_back( coreList.at( i ).toInt() );
+        aruco::ThreadPool::configureGlobal( 0, cores );
+    }
+
+    if( parser.isSet( traceOption ) )
+    {
+        aruco::Tracer::start();
+        aruco::Tracer::setThreadName( "gui" );
+    }
+
+    Scene scene( frameSource, detectionThreads, parser.value( reduceOption ).toInt() );
+    scene.setMeasuringLatency( parser.isSet( latencyOption ) );
     scene.showFullScreen();
 //    scene.show();
 //    scene.showMaximized();
 
-    return application.exec();
-}
+    int result = application.exec();
+
+    if( parser.isSet( traceOption ) )
+    {
+        aruco::Tracer::stop();
+        if( !aruco::Tracer::write( parser.value( traceOption ).toStdString() ) )
+            qDebug() << "Could not write" << parser.value( traceOption );
+    }
 
+    return result;
+}
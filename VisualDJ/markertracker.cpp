@@ -0,0 +1,99 @@
+#include "markertracker.hpp"
+#include "aruco/ar_timers.h"
+
+#include <cmath>
+
+#define WINDOW_SIZE         21      // Pixels, of the Lucas-Kanade window
+#define PYRAMID_LEVELS      3
+#define MAX_BACK_ERROR      1.0f    // Pixels, between a corner and the same corner tracked there and back
+#define MAX_SIDE_CHANGE     0.2f    // Of the side length, from one frame to the next
+
+MarkerTracker::MarkerTracker()
+{
+}
+
+void MarkerTracker::reset( const Mat &grayscale, const std::vector< Marker > &markers )
+{
+    this->markers = markers;
+    if( markers.empty() )
+        return;
+
+    // A copy, the caller reuses the buffer of grayscale for the next frame
+    buildOpticalFlowPyramid( grayscale, previousPyramid, Size( WINDOW_SIZE, WINDOW_SIZE ), PYRAMID_LEVELS,
+                             true, BORDER_REFLECT_101, BORDER_CONSTANT, false );
+}
+
+bool MarkerTracker::track( const Mat &grayscale, std::vector< Marker > &trackedMarkers )
+{
+    ARUCO_SCOPED_TIMER( "MarkerTracker::track" );
+
+    if( markers.empty() )
+        return false;
+
+    buildOpticalFlowPyramid( grayscale, currentPyramid, Size( WINDOW_SIZE, WINDOW_SIZE ), PYRAMID_LEVELS,
+                             true, BORDER_REFLECT_101, BORDER_CONSTANT, false );
+
+    previousCorners.clear();
+    for( size_t i = 0; i < markers.size(); i++ )
+        previousCorners.insert( previousCorners.end(), markers.at( i ).begin(), markers.at( i ).end() );
+
+    TermCriteria criteria( TermCriteria::COUNT | TermCriteria::EPS, 20, 0.03 );
+    calcOpticalFlowPyrLK( previousPyramid, currentPyramid, previousCorners, corners, status, errors,
+                          Size( WINDOW_SIZE, WINDOW_SIZE ), PYRAMID_LEVELS, criteria );
+
+    // Back from where they landed, starting at where they were. A corner that slid along
+    // an edge or jumped to another corner does not come back to the same place
+    backCorners = previousCorners;
+    calcOpticalFlowPyrLK( currentPyramid, previousPyramid, corners, backCorners, backStatus, errors,
+                          Size( WINDOW_SIZE, WINDOW_SIZE ), PYRAMID_LEVELS, criteria, OPTFLOW_USE_INITIAL_FLOW );
+
+    for( size_t i = 0; i < corners.size(); i++ )
+    {
+        Point2f backError = backCorners.at( i ) - previousCorners.at( i );
+        if( !status.at( i ) || !backStatus.at( i ) || backError.dot( backError ) > MAX_BACK_ERROR * MAX_BACK_ERROR )
+            return false;
+    }
+
+    trackedMarkers = markers;
+    for( size_t i = 0; i < trackedMarkers.size(); i++ )
+    {
+        Marker &marker = trackedMarkers[ i ];
+        for( int c = 0; c < 4; c++ )
+            marker[ c ] = corners.at( i * 4 + c );
+
+        if( !isValidMove( markers.at( i ), marker, grayscale.size() ) )
+            return false;
+
+        // The cells are read straight from the image, with no warp. The corners keep the
+        // order of the detection, so the marker must be read with no rotation
+        int rotations;
+        if( FiducidalMarkers::detectInImage( grayscale, marker, rotations ) != marker.id || rotations != 0 )
+            return false;
+    }
+
+    markers = trackedMarkers;
+    previousPyramid.swap( currentPyramid );
+    return true;
+}
+
+bool MarkerTracker::isValidMove( const Marker &from, const Marker &to, const Size &imageSize ) const
+{
+    Rect image( 0, 0, imageSize.width, imageSize.height );
+    for( int c = 0; c < 4; c++ )
+    {
+        if( !image.contains( to.at( c ) ) )
+            return false;
+
+        float fromSide = norm( from.at( c ) - from.at( ( c + 1 ) % 4 ) );
+        float toSide = norm( to.at( c ) - to.at( ( c + 1 ) % 4 ) );
+        if( fromSide <= 0 || std::fabs( toSide / fromSide - 1 ) > MAX_SIDE_CHANGE )
+            return false;
+    }
+
+    return isContourConvex( static_cast< const std::vector< Point2f > & >( to ) );
+}
+
+bool MarkerTracker::isEmpty() const
+{
+    return markers.empty();
+}
@@ -0,0 +1,56 @@
+#ifndef MARKERTRACKER_HPP
+#define MARKERTRACKER_HPP
+
+#include <vector>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/video/tracking.hpp>
+
+#include "aruco/aruco.h"
+#include "aruco/arucofidmarkers.h"
+
+using namespace cv;
+using namespace aruco;
+
+// Follows the four corners of each marker from one frame to the next with pyramidal
+// Lucas-Kanade optical flow, much cheaper than detecting the markers again.
+//
+// A marker is lost when a corner is not found, when tracking a corner back does not land
+// where it started (drift), when the quad stops being convex or changes its shape too
+// much, or when its cells no longer decode to its id. Then track() fails and the caller
+// has to detect the markers again.
+class MarkerTracker
+{
+private:
+
+    // Pyramids of the last frame and of the current one, swapped after each frame
+    std::vector< Mat > previousPyramid;
+    std::vector< Mat > currentPyramid;
+
+    std::vector< Marker > markers;
+    std::vector< Point2f > previousCorners;
+    std::vector< Point2f > corners;
+    std::vector< Point2f > backCorners;
+    std::vector< uchar > status;
+    std::vector< uchar > backStatus;
+    std::vector< float > errors;
+
+    bool isValidMove( const Marker &from, const Marker &to, const Size &imageSize ) const;
+
+    MarkerTracker( const MarkerTracker & );
+    MarkerTracker &operator=( const MarkerTracker & );
+
+public:
+
+    MarkerTracker();
+
+    // Starts over from markers, just detected in grayscale
+    void reset( const Mat &grayscale, const std::vector< Marker > &markers );
+
+    // Moves the markers of the last frame to grayscale. The pose is not computed.
+    // Returns false if any marker was lost, the markers of the last frame are kept then
+    bool track( const Mat &grayscale, std::vector< Marker > &trackedMarkers );
+
+    bool isEmpty() const;
+};
+
+#endif // MARKERTRACKER_HPP
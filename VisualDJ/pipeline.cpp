@@ -0,0 +1,273 @@
+#include "pipeline.hpp"
+#include "aruco/ar_timers.h"
+#include "aruco/ar_threadpool.h"
+
+#include <QDebug>
+
+#define QUEUE_CAPACITY  2
+#define WAIT_TIMEOUT    20      // ms, how often the stages check if they must stop
+
+DispatchStage::DispatchStage( FrameMailbox *input, const QVector< FrameQueue * > &outputs,
+                              QObject *parent ) : QThread( parent ),
+                                                  input( input ),
+                                                  outputs( outputs ),
+                                                  running( 1 )
+{
+}
+
+void DispatchStage::stop()
+{
+    running.store( 0 );
+    wait();
+}
+
+void DispatchStage::run()
+{
+    int next = 0;
+    aruco::Tracer::setThreadName( "dispatch" );
+
+    while( running.load() )
+    {
+        Frame frame;
+        if( !input->waitForFrame( frame, WAIT_TIMEOUT ) )
+            continue;
+
+        aruco::Tracer::setFrame( frame.id );
+
+        // Strict round robin, the composite stage relies on it to restore the order.
+        // While the next detector is busy the mailbox keeps only the newest frame
+        while( running.load() && !outputs.at( next )->push( frame, WAIT_TIMEOUT ) )
+            ;
+
+        next = ( next + 1 ) % outputs.size();
+    }
+}
+
+
+DetectionStage::DetectionStage( FrameQueue *input, FrameQueue *output,
+                                const CameraParameters &cameraParameters, QObject *parent ) : QThread( parent ),
+                                                                                              input( input ),
+                                                                                              output( output ),
+                                                                                              frameDetector( new FrameDetector( cameraParameters ) ),
+                                                                                              running( 1 )
+{
+}
+
+DetectionStage::~DetectionStage()
+{
+    delete frameDetector;
+}
+
+void DetectionStage::stop()
+{
+    running.store( 0 );
+    wait();
+}
+
+FrameDetector *DetectionStage::getFrameDetector() const
+{
+    return frameDetector;
+}
+
+void DetectionStage::run()
+{
+    aruco::Tracer::setThreadName( "detection" );
+
+    // The stage runs detection tasks too while it waits for them, so it goes on the same cores as the pool
+    const std::vector< int > &cores = aruco::ThreadPool::global().getCores();
+    if( !cores.empty() && !aruco::ThreadPool::pinCurrentThread( cores ) )
+        qDebug() << "Could not pin a detection thread to the vision cores";
+
+    while( running.load() )
+    {
+        Frame frame;
+        if( !input->pop( frame, WAIT_TIMEOUT ) )
+            continue;
+
+        aruco::Tracer::setFrame( frame.id );
+
+        frameDetector->process( frame );
+
+        // The image belongs to the mailbox, it is not needed downstream
+        frame.image.release();
+        frame.detectedAt = Frame::now();
+
+        while( running.load() && !output->push( frame, WAIT_TIMEOUT ) )
+            ;
+    }
+}
+
+
+CompositeStage::CompositeStage( const QVector< FrameQueue * > &inputs, FrameQueue *output,
+                                Compositor *compositor, QObject *parent ) : QThread( parent ),
+                                                                            inputs( inputs ),
+                                                                            output( output ),
+                                                                            compositor( compositor ),
+                                                                            running( 1 )
+{
+}
+
+void CompositeStage::stop()
+{
+    running.store( 0 );
+    wait();
+}
+
+void CompositeStage::run()
+{
+    int next = 0;
+    aruco::Tracer::setThreadName( "composite" );
+
+    while( running.load() )
+    {
+        // Waits for the detector that got the oldest frame still in flight
+        Frame frame;
+        if( !inputs.at( next )->pop( frame, WAIT_TIMEOUT ) )
+            continue;
+
+        aruco::Tracer::setFrame( frame.id );
+
+        next = ( next + 1 ) % inputs.size();
+
+        compositor->process( frame );
+        frame.compositedAt = Frame::now();
+
+        bool pushed = false;
+        while( running.load() && !( pushed = output->push( frame, WAIT_TIMEOUT ) ) )
+            ;
+
+        if( pushed )
+            emit frameComposited();
+    }
+}
+
+
+Pipeline::Pipeline( FrameSource *frameSource, const CameraParameters &cameraParameters,
+                    int detectionThreads, QObject *parent ) : QObject( parent ),
+                                                              frameMailbox( new FrameMailbox ),
+                                                              compositedFrames( new FrameQueue( QUEUE_CAPACITY ) ),
+
+                                                              // Queued overlays, the one being drawn and the one shown
+                                                              compositor( new Compositor( QUEUE_CAPACITY + 2 ) ),
+
+                                                              captureThread( new CaptureThread( frameSource, frameMailbox ) ),
+                                                              takenFrames( 0 )
+{
+    detectionThreads = qMax( 1, detectionThreads );
+
+    // A detector holds at most one pending frame, more would only add latency
+    for( int i = 0; i < detectionThreads; i++ )
+    {
+        pendingFrames.append( new FrameQueue( 1 ) );
+        detectedFrames.append( new FrameQueue( QUEUE_CAPACITY ) );
+        detectionStages.append( new DetectionStage( pendingFrames.at( i ), detectedFrames.at( i ), cameraParameters ) );
+    }
+
+    dispatchStage = new DispatchStage( frameMailbox, pendingFrames );
+    compositeStage = new CompositeStage( detectedFrames, compositedFrames, compositor );
+
+    // Queued, the stages run on their own threads
+    connect( compositeStage, SIGNAL( frameComposited() ), SIGNAL( frameReady() ) );
+    connect( captureThread, SIGNAL( finished() ), SIGNAL( captureFinished() ) );
+}
+
+Pipeline::~Pipeline()
+{
+    stop();
+
+    delete compositeStage;
+    delete dispatchStage;
+    qDeleteAll( detectionStages );
+    delete captureThread;
+    delete compositor;
+    delete compositedFrames;
+    qDeleteAll( detectedFrames );
+    qDeleteAll( pendingFrames );
+    delete frameMailbox;
+}
+
+void Pipeline::start()
+{
+    captureThread->start();
+    dispatchStage->start();
+    for( int i = 0; i < detectionStages.size(); i++ )
+        detectionStages.at( i )->start();
+    compositeStage->start();
+}
+
+void Pipeline::stop()
+{
+    // Upstream first, so nothing new enters a stage that already stopped
+    captureThread->stop();
+    dispatchStage->stop();
+    for( int i = 0; i < detectionStages.size(); i++ )
+        detectionStages.at( i )->stop();
+    compositeStage->stop();
+}
+
+bool Pipeline::takeFrame( Frame &frame )
+{
+    if( !compositedFrames->tryPop( frame ) )
+        return false;
+
+    takenFrames.fetchAndAddRelaxed( 1 );
+    return true;
+}
+
+bool Pipeline::isFinished() const
+{
+    if( !captureThread->isFinished() )
+        return false;
+
+    return takenFrames.load() + getDroppedFrames() == captureThread->getFrameCount();
+}
+
+Compositor *Pipeline::getCompositor() const
+{
+    return compositor;
+}
+
+void Pipeline::setRescanInterval( int frames )
+{
+    for( int i = 0; i < detectionStages.size(); i++ )
+        detectionStages.at( i )->getFrameDetector()->setRescanInterval( frames );
+}
+
+void Pipeline::setOpticalFlow( bool enabled )
+{
+    for( int i = 0; i < detectionStages.size(); i++ )
+        detectionStages.at( i )->getFrameDetector()->setOpticalFlow( enabled );
+}
+
+void Pipeline::setChangeDetection( bool enabled )
+{
+    for( int i = 0; i < detectionStages.size(); i++ )
+        detectionStages.at( i )->getFrameDetector()->setChangeDetection( enabled );
+}
+
+void Pipeline::setParallelContours( bool enabled )
+{
+    for( int i = 0; i < detectionStages.size(); i++ )
+        detectionStages.at( i )->getFrameDetector()->getMarkerDetector()->enableParallelContours( enabled );
+}
+
+void Pipeline::setAutoReduction( int minMarkerPixels )
+{
+    for( int i = 0; i < detectionStages.size(); i++ )
+        detectionStages.at( i )->getFrameDetector()->setAutoReduction( minMarkerPixels );
+}
+
+int Pipeline::getDetectionThreads() const
+{
+    return detectionStages.size();
+}
+
+int Pipeline::getDroppedFrames() const
+{
+    return frameMailbox->getDroppedFrames();
+}
+
+int Pipeline::getCapturedFrames() const
+{
+    return captureThread->getFrameCount();
+}
@@ -0,0 +1,164 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <QObject>
+#include <QVector>
+#include <QThread>
+#include <QAtomicInt>
+
+#include "aruco/aruco.h"
+#include "frame.hpp"
+#include "spscqueue.hpp"
+#include "framemailbox.hpp"
+#include "capturethread.hpp"
+#include "framedetector.hpp"
+#include "compositor.hpp"
+
+using namespace cv;
+using namespace aruco;
+
+typedef SpscQueue< Frame > FrameQueue;
+
+// Takes the newest camera frame and hands it to the detection stages in turn
+class DispatchStage : public QThread
+{
+    Q_OBJECT
+
+private:
+
+    FrameMailbox *input;
+    QVector< FrameQueue * > outputs;
+    QAtomicInt running;
+
+public:
+
+    DispatchStage( FrameMailbox *input, const QVector< FrameQueue * > &outputs, QObject *parent = 0 );
+
+    void stop();
+
+protected:
+
+    void run();
+};
+
+// Finds the markers of a frame. Every stage has its own detector and buffers,
+// so several of them can work on consecutive frames at the same time. The parallel
+// parts of the detection of all the stages run in the shared aruco::ThreadPool.
+// The tracking state is per detector too, with N stages each one follows the
+// markers over frames N apart, so more than one stage is only worth it when a
+// single one cannot keep up with the camera
+class DetectionStage : public QThread
+{
+    Q_OBJECT
+
+private:
+
+    FrameQueue *input;
+    FrameQueue *output;
+    FrameDetector *frameDetector;
+    QAtomicInt running;
+
+public:
+
+    DetectionStage( FrameQueue *input, FrameQueue *output,
+                    const CameraParameters &cameraParameters, QObject *parent = 0 );
+    ~DetectionStage();
+
+    void stop();
+
+    // Only to be used while the stage is not running
+    FrameDetector *getFrameDetector() const;
+
+protected:
+
+    void run();
+};
+
+// Draws the overlay of each detected frame. Takes the detection results in the
+// same order the frames were dispatched, so frames are never shown out of order
+class CompositeStage : public QThread
+{
+    Q_OBJECT
+
+private:
+
+    QVector< FrameQueue * > inputs;
+    FrameQueue *output;
+    Compositor *compositor;
+    QAtomicInt running;
+
+public:
+
+    CompositeStage( const QVector< FrameQueue * > &inputs, FrameQueue *output, Compositor *compositor, QObject *parent = 0 );
+
+    void stop();
+
+protected:
+
+    void run();
+
+signals:
+
+    void frameComposited();
+};
+
+// capture -> dispatch -> detect (one or more) -> composite, each stage on its own thread.
+// The GUI thread is the render stage, it only uploads the overlay and paints.
+// Queues are short so a slow stage pushes back instead of building latency.
+class Pipeline : public QObject
+{
+    Q_OBJECT
+
+private:
+
+    FrameMailbox *frameMailbox;
+    QVector< FrameQueue * > pendingFrames;     // One per detection stage
+    QVector< FrameQueue * > detectedFrames;    // One per detection stage
+    FrameQueue *compositedFrames;
+    Compositor *compositor;
+
+    CaptureThread *captureThread;
+    DispatchStage *dispatchStage;
+    QVector< DetectionStage * > detectionStages;
+    CompositeStage *compositeStage;
+
+    QAtomicInt takenFrames;
+
+public:
+
+    Pipeline( FrameSource *frameSource, const CameraParameters &cameraParameters,
+              int detectionThreads = 1, QObject *parent = 0 );
+    ~Pipeline();
+
+    void start();
+    void stop();
+
+    // Render side. Returns the composited frames in capture order
+    bool takeFrame( Frame &frame );
+
+    // The source ended and every frame it gave was taken or dropped
+    bool isFinished() const;
+
+    Compositor *getCompositor() const;
+    int getDetectionThreads() const;
+
+    // Before start()
+    void setRescanInterval( int frames );
+    void setOpticalFlow( bool enabled );
+    void setChangeDetection( bool enabled );
+    void setParallelContours( bool enabled );
+    void setAutoReduction( int minMarkerPixels );
+
+    int getDroppedFrames() const;
+    int getCapturedFrames() const;
+
+signals:
+
+    // A composited frame can be taken. Emitted once per frame, in the thread of the pipeline
+    void frameReady();
+
+    // No more frames will be captured, the ones in flight still arrive with frameReady()
+    void captureFinished();
+};
+
+#endif // PIPELINE_HPP
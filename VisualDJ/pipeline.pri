@@ -0,0 +1,37 @@
+#-------------------------------------------------
+#
+# Captura, deteccion y composicion, sin interfaz grafica.
+# Compartido por la aplicacion y el benchmark
+#
+#-------------------------------------------------
+
+QT += core
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+           $$PWD/frame.cpp \
+           $$PWD/latencyrecord.cpp \
+           $$PWD/framesource.cpp \
+           $$PWD/framemailbox.cpp \
+           $$PWD/capturethread.cpp \
+           $$PWD/binarize.cpp \
+           $$PWD/markertracker.cpp \
+           $$PWD/changedetector.cpp \
+           $$PWD/framedetector.cpp \
+           $$PWD/compositor.cpp \
+           $$PWD/pipeline.cpp
+
+HEADERS += \
+           $$PWD/frame.hpp \
+           $$PWD/latencyrecord.hpp \
+           $$PWD/framesource.hpp \
+           $$PWD/framemailbox.hpp \
+           $$PWD/capturethread.hpp \
+           $$PWD/spscqueue.hpp \
+           $$PWD/binarize.hpp \
+           $$PWD/markertracker.hpp \
+           $$PWD/changedetector.hpp \
+           $$PWD/framedetector.hpp \
+           $$PWD/compositor.hpp \
+           $$PWD/pipeline.hpp
@@ -1,14 +1,38 @@
 #include "scene.hpp"
+#include "aruco/ar_timers.h"
+#include "aruco/ar_threadpool.h"
 
-Scene::Scene( QWidget *parent ) : QGLWidget( parent ),
+#include <QGuiApplication>
+#include <QScreen>
+
+namespace
+{
+    // Swaps wait for the vertical retrace, the GUI thread renders at the display refresh
+    QGLFormat syncedFormat()
+    {
+        QGLFormat format = QGLFormat::defaultFormat();
+        format.setSwapInterval( 1 );
+        return format;
+    }
+}
+
+Scene::Scene( FrameSource *frameSource, int detectionThreads, int minMarkerPixels, QWidget *parent ) : QGLWidget( syncedFormat(), parent ),
 
                                   resolutionRelation( 2.14 ),
                                   horizontalDisplacement( -15 ),
                                   verticalDisplacement( -94 ),
-                                  rotationAngle( 0 ),
 
-                                  videoCapture ( new cv::VideoCapture( 1 ) ),
-                                  sceneTimer ( new QTimer ),
+                                  frameSource( frameSource ),
+                                  sourceFinished( false ),
+                                  refreshPeriod( 1000000000 / 60 ),
+                                  skippedFrames( 0 ),
+                                  lateFrames( 0 ),
+
+                                  measuringLatency( false ),
+                                  detectionLatency( new LatencyRecord( "detection" ) ),
+                                  overlayLatency( new LatencyRecord( "overlay" ) ),
+                                  audioLatency( new LatencyRecord( "audio" ) ),
+                                  photonLatency( new LatencyRecord( "photon" ) ),
 
                                   textures( new QVector< Texture * > ),
                                   sounds( new QVector< Sound * > ),
@@ -17,13 +41,73 @@ Scene::Scene( QWidget *parent ) : QGLWidget( parent ),
                                   tracksCount( 0 ),
 
                                   cameraParameters( new CameraParameters ),
-                                  markerDetector( new MarkerDetector )
+                                  pipeline( 0 )
 {
     this->setMinimumSize( GRAPHICS_WIDTH, GRAPHICS_HEIGHT );
     cameraParameters->readFromXMLFile( "../files/camera_parameters.yml" );
 
-    connect( sceneTimer, SIGNAL( timeout() ), SLOT( slotProcess() ) );
-    sceneTimer->start( 10 );
+    qDebug() << "Source:" << frameSource->getDescription()
+             << ( frameSource->isRealTime() ? "real time" : "as fast as possible" )
+             << "Detection threads:" << detectionThreads
+             << "Vision pool threads:" << aruco::ThreadPool::global().size();
+
+    if( QGuiApplication::primaryScreen() && QGuiApplication::primaryScreen()->refreshRate() > 0 )
+        refreshPeriod = 1e9 / QGuiApplication::primaryScreen()->refreshRate();
+
+    // Each detection stage keeps its own copy of the camera parameters
+    pipeline = new Pipeline( frameSource, *cameraParameters, detectionThreads );
+    pipeline->setAutoReduction( minMarkerPixels );
+    updateCalibration();
+
+    // Runs when there is something new to show, not on a timer
+    connect( pipeline, SIGNAL( frameReady() ), SLOT( slotProcess() ) );
+    connect( pipeline, SIGNAL( captureFinished() ), SLOT( slotProcess() ) );
+    pipeline->start();
+}
+
+Scene::~Scene()
+{
+    pipeline->stop();
+
+    qDebug() << "Captured frames:" << pipeline->getCapturedFrames()
+             << "Dropped frames:" << pipeline->getDroppedFrames()
+             << "Frames not shown:" << skippedFrames
+             << "Late frames:" << lateFrames;
+    printLatencies();
+    qDebug().noquote() << QString::fromStdString( aruco::Timers::report() );
+
+    delete pipeline;
+    delete frameSource;
+
+    delete detectionLatency;
+    delete overlayLatency;
+    delete audioLatency;
+    delete photonLatency;
+}
+
+void Scene::setMeasuringLatency( bool value )
+{
+    measuringLatency = value;
+}
+
+int Scene::getSkippedFrames() const
+{
+    return skippedFrames;
+}
+
+int Scene::getLateFrames() const
+{
+    return lateFrames;
+}
+
+void Scene::printLatencies()
+{
+    if( !measuringLatency )
+        return;
+
+    qDebug().noquote() << "Latency from capture:\n"
+                       << detectionLatency->toString() + overlayLatency->toString()
+                        + audioLatency->toString() + photonLatency->toString();
 }
 
 
@@ -69,6 +153,8 @@ void Scene::loadSounds()
     for( int i = 0; i < soundFiles.size(); i++ )
         sounds->append( new Sound( soundFiles.at( i ), currentTrackIndex ) );
 
+    pipeline->getCompositor()->setSounds( soundFiles );
+
     for( int i = 0; i < sounds->size(); i++ )
         sounds->at( i )->player->play();
 }
@@ -85,160 +171,9 @@ void Scene::loadVideos()
         videos->append( new Video( videoFiles.at( i ) ) );
 }
 
-void Scene::process( Mat &frame )
-{
-    Mat grayscaleMat;
-    cvtColor( frame, grayscaleMat, CV_BGR2GRAY );
-
-    Mat binaryMat;
-    threshold( grayscaleMat, binaryMat, 128, 255, cv::THRESH_BINARY );
-
-    std::vector< Marker > detectedMarkersVector;
-    cameraParameters->resize( binaryMat.size() );
-    markerDetector->detect( binaryMat, detectedMarkersVector, *cameraParameters, 0.08f );
-    detectedMarkers = QVector< Marker >::fromStdVector( detectedMarkersVector );
-
-//    qDebug() << "Marcadores" << detectedMarkers.size();
-
-
-    // Si se detecta el marcador 20, le cambia su id a 4. No se por que.
-    for( int i = 0; i < detectedMarkers.size(); i++ )
-    {
-        if( detectedMarkers.at( i ).id == 20 )
-        {
-            detectedMarkers.operator []( i ).id = 4;
-        }
-    }
-
-    // Pone todos los sonidos en no detectado
-    for( int i = 0; i < sounds->size(); i++ )
-    {
-        sounds->at( i )->isDetected = false;
-    }
-
-
-    for( int i = 0; i < detectedMarkers.size(); i++ )
-    {
-//        int currentMarkerId = detectedMarkers.at( i ).id - 6;  // No se por que le restaba 6
-        int currentMarkerId = detectedMarkers.at( i ).id;
-
-        detectedMarkers.at( i ).draw( textures->operator []( 1 )->mat, Scalar( 255, 0, 255 ), 1 );
-
-        // Esto dibuja en pequeno sector, el id y el rectangulo de cada marcador detectado
-        Point projectedCenter = detectedMarkers.at( i ).getCenter();
-        projectedCenter.x *= resolutionRelation;
-        projectedCenter.x += horizontalDisplacement;
-        projectedCenter.y *= resolutionRelation;
-        projectedCenter.y += verticalDisplacement;
-
-//         drawAura( projectedCenter );
-
-        qDebug() << "currentMarkerId" << currentMarkerId << "sounds->size()" << sounds->size();
-
-        if( currentMarkerId < sounds->size() )
-        {
-            sounds->at( currentMarkerId )->isDetected = true;
-
-            int volume = ( GRAPHICS_HEIGHT - projectedCenter.y ) * 100 / ( float )GRAPHICS_HEIGHT;
-            sounds->at( currentMarkerId )->player->setVolume( volume );
-
-            drawPeak( currentMarkerId, projectedCenter );
-        }
-
-        drawTitle( currentMarkerId, projectedCenter );
-    }
-
-    for( int i = 0; i < sounds->size(); i++ )
-    {
-        if( !sounds->at( i )->isDetected )
-        {
-            sounds->at( i )->player->setVolume( sounds->at( i )->player->volume() - 5 );
-        }
-    }
-}
-
-
-void Scene::drawAura( Point center )
-{
-    int lines = 50;
-    int maxRadius = 200;
-
-    for( int i = 0; i <= lines; i++ )
-    {
-        circle( textures->operator []( 1 )->mat, center, maxRadius / ( float )lines * i, Scalar( 0, 0, 255 ), 1 );
-    }
-
-    float angle = rotationAngle;
-
-    lines = 50;
-    for( int i = 0; i < lines; i++ )
-    {
-        float localAngle = angle * 3.14159264 / ( float )180;
-
-        line( textures->operator []( 1 )->mat,
-              center,
-              Point( center.x + maxRadius * cos( localAngle ), center.y + maxRadius * sin( localAngle ) ),
-              Scalar( 255, 0, 0 ) );
-
-        angle += 360 / ( float )lines;
-    }
-}
-
-void Scene::drawTitle( int id, Point center )
-{
-    if( id < sounds->size() )
-    {
-        QString title = sounds->at( id )->name;
-        title.remove( ".mp3" );
-        putText( textures->operator []( 1 )->mat,
-                 title.toStdString().c_str(),
-                 Point( center.x - title.length() * 10,
-                        GRAPHICS_HEIGHT - 100 ),
-                 FONT_HERSHEY_PLAIN, 2, Scalar( 0, 0, 255 ), 2 );
-
-    }
-}
-
-void Scene::drawPeak( int soundIndex, Point markerCenter )
+void Scene::updateCalibration()
 {
-    float peakValue = sounds->at( soundIndex )->leftSpectrum;
-    float maxLenght = GRAPHICS_HEIGHT - markerCenter.y;
-    float lenght = 2 * peakValue * maxLenght;
-
-    Rect bar( markerCenter.x - 100,
-              GRAPHICS_HEIGHT - lenght,
-              200,
-              lenght );
-
-    Rect bar1 = bar;
-    bar1.x += 5;
-    bar1.width -= 10;
-    bar1.y += 5;
-    bar1.height -= 5;
-
-    Rect bar2 = bar1;
-    bar2.x += 5;
-    bar2.width -= 10;
-    bar2.y += 5;
-    bar2.height -= 5;
-
-    rectangle( textures->at( 1 )->mat, bar, Scalar( 0, 0, 255 ), 5 );
-    rectangle( textures->at( 1 )->mat, bar1, Scalar( 255, 0, 0 ), 5 );
-    rectangle( textures->at( 1 )->mat, bar2, Scalar( 255, 0, 0 ), 5 );
-
-    int radioCirculoInterior = 105;
-
-    // Circulo interior
-    circle( textures->at( 1 )->mat, markerCenter,
-            radioCirculoInterior + lenght / 400, Scalar( 0, 0, 255 ), lenght / 10 );
-
-    // Circulo medio
-    circle( textures->at( 1 )->mat, markerCenter,
-            radioCirculoInterior+25 + lenght / 400, Scalar( 255, 0, 255 ), lenght / 8 );
-
-    // Circulo exterior
-    circle( textures->at( 1 )->mat, markerCenter,
-            radioCirculoInterior+50 + lenght / 500, Scalar( 255, 0, 0 ), lenght / 6 );
+    pipeline->getCompositor()->setCalibration( resolutionRelation, horizontalDisplacement, verticalDisplacement );
 }
 
 void Scene::drawBox( QString textureName, int percentage )
@@ -368,6 +303,8 @@ void Scene::resizeGL( int width, int height )
 
 void Scene::paintGL()
 {
+    ARUCO_SCOPED_TIMER( "Scene::paintGL" );
+
     glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
 
     glMatrixMode( GL_PROJECTION );
@@ -467,9 +404,16 @@ void Scene::keyPressEvent( QKeyEvent *event )
         this->close();
         break;
 
+    case Qt::Key_T:
+        qDebug().noquote() << QString::fromStdString( aruco::Timers::report() );
+        printLatencies();
+        return;
+
     default: break;
     }
 
+    updateCalibration();
+
     qDebug() << "Relación de resolucion: " << resolutionRelation;
     qDebug() << "Desplazamiento horizontal: " << horizontalDisplacement;
     qDebug() << "Desplazamiento vertical: " << verticalDisplacement;
@@ -477,15 +421,92 @@ void Scene::keyPressEvent( QKeyEvent *event )
 
 void Scene::slotProcess()
 {
+    ARUCO_SCOPED_TIMER( "Scene::slotProcess" );
 
-    videoCapture->operator >>( textures->operator []( 0 )->mat );
-    textures->operator []( 1 )->mat.setTo( Scalar( 0, 0, 0 ) );
+    // Detection and overlay drawing run on the pipeline threads, here we only show the result.
+    // Every frame drives the sounds, so a replay gives the same volumes no matter the timing,
+    // but only the newest overlay is uploaded. The frames that queued while the last one was
+    // being shown are stale, they are skipped instead of shown one per refresh
+    Frame frame;
+    int framesTaken = 0;
+
+    while( pipeline->takeFrame( frame ) )
+    {
+        framesTaken++;
+        bool markerHeard = false;
+
+        for( int i = 0; i < sounds->size(); i++ )
+        {
+            int volume = i < frame.volumes.size() ? frame.volumes.at( i ) : Frame::NOT_DETECTED;
+            sounds->at( i )->isDetected = volume != Frame::NOT_DETECTED;
+
+            if( sounds->at( i )->isDetected )
+            {
+                sounds->at( i )->player->setVolume( volume );
+                markerHeard = true;
+            }
+            else
+                sounds->at( i )->player->setVolume( sounds->at( i )->player->volume() - 5 );
+        }
+
+        frame.volumesAppliedAt = Frame::now();
+
+        if( measuringLatency )
+        {
+            detectionLatency->append( frame.detectedAt - frame.capturedAt );
+            overlayLatency->append( frame.compositedAt - frame.capturedAt );
+
+            // Marker in front of the camera -> its stem plays at the new volume.
+            // Frames with no marker only fade the sounds out, they are not a reaction
+            if( markerHeard )
+                audioLatency->append( frame.volumesAppliedAt - frame.capturedAt );
+        }
+    }
+
+    // The last frame may have been taken before the capture finished, so this is checked
+    // every time and not only when nothing arrived
+    if( !sourceFinished && pipeline->isFinished() )
+    {
+        sourceFinished = true;
+        qDebug() << "End of" << frameSource->getDescription();
+
+        // A run as fast as possible is a benchmark or a profile, it ends with the recording
+        if( frameSource->isLossless() )
+        {
+            this->close();
+            return;
+        }
+    }
 
-    rotationAngle += 1;
-    process( textures->operator []( 0 )->mat );
+    // Every frame sends a frameReady(), the ones already taken here arrive with nothing left
+    if( framesTaken == 0 )
+        return;
 
-    textures->operator []( 0 )->generateFromMat();
+    skippedFrames += framesTaken - 1;
+    aruco::Tracer::setFrame( frame.id );
+    detectedMarkers = frame.markers;
+
+    // The compositor draws the peaks with the spectrum of the next frames
+    QVector< float > levels;
+    for( int i = 0; i < sounds->size(); i++ )
+        levels << sounds->at( i )->leftSpectrum;
+    pipeline->getCompositor()->setLevels( levels );
+
+    textures->operator []( 1 )->mat = frame.graphics;
     textures->operator []( 1 )->generateFromMat();
 
     this->updateGL();
+
+    // Swapped more than two refreshes after it was ready, so it missed at least one
+    if( Frame::now() - frame.compositedAt > 2 * refreshPeriod )
+        lateFrames++;
+
+    if( measuringLatency )
+    {
+        // The buffers were swapped, wait until the GPU is done with this frame
+        this->makeCurrent();
+        glFinish();
+        frame.presentedAt = Frame::now();
+        photonLatency->append( frame.presentedAt - frame.capturedAt );
+    }
 }
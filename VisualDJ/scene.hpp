@@ -1,12 +1,6 @@
 #ifndef SCENE_HPP
 #define SCENE_HPP
 
-//#define GRAPHICS_WIDTH  1920
-//#define GRAPHICS_HEIGHT 1080
-
-#define GRAPHICS_WIDTH  1280
-#define GRAPHICS_HEIGHT 720
-
 #include <QDir>
 #include <QDebug>
 #include <QTimer>
@@ -24,6 +18,9 @@
 #include "texture.hpp"
 #include "sound.hpp"
 #include "video.hpp"
+#include "framesource.hpp"
+#include "pipeline.hpp"
+#include "latencyrecord.hpp"
 
 using namespace cv;
 using namespace aruco;
@@ -38,11 +35,20 @@ private:
     float resolutionRelation;
     float horizontalDisplacement;
     float verticalDisplacement;
-    float rotationAngle;
 
     // Scene
-    VideoCapture *videoCapture;
-    QTimer *sceneTimer;
+    FrameSource *frameSource;
+    bool sourceFinished;
+    qint64 refreshPeriod;       // ns
+    int skippedFrames;          // Taken together with a newer one, never shown
+    int lateFrames;             // Shown after missing the refresh they were ready for
+
+    // Latency measurement, from the capture of a frame
+    bool measuringLatency;
+    LatencyRecord *detectionLatency;
+    LatencyRecord *overlayLatency;
+    LatencyRecord *audioLatency;
+    LatencyRecord *photonLatency;
 
     // Mixer
     QVector< Texture * > *textures;
@@ -53,23 +59,30 @@ private:
 
     // Marker detection
     CameraParameters *cameraParameters;
-    MarkerDetector *markerDetector;
+    Pipeline *pipeline;
     QVector< Marker > detectedMarkers;
 
     void loadTextures();
     void loadSounds();
     void loadVideos();
 
-    void process( Mat &frame );
-    void drawAura( Point center );
-    void drawTitle( int id, Point center );
-    void drawPeak( int soundIndex, Point markerCenter );
+    void updateCalibration();
     void drawBox( QString textureName, int percentage = 100 );
     void drawVideo( QString videoName );
+    void printLatencies();
 
 public:
 
-    Scene( QWidget *parent = 0 );
+    // Takes ownership of the frame source. minMarkerPixels, see FrameDetector::setAutoReduction()
+    explicit Scene( FrameSource *frameSource, int detectionThreads = 1, int minMarkerPixels = 0, QWidget *parent = 0 );
+    ~Scene();
+
+    // Stamps every frame until its volumes are set and until it is on screen.
+    // Waits for the GPU after every paint, so it costs some frame rate
+    void setMeasuringLatency( bool value );
+
+    int getSkippedFrames() const;
+    int getLateFrames() const;
 
 protected:
 
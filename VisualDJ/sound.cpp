@@ -1,5 +1,6 @@
 #include "sound.hpp"
 #include <QDebug>
+#include "aruco/ar_timers.h"
 
 Sound::Sound( QString name, int folderIndex, QObject *parent ) : QObject( parent ),
                                                                  name( name ),
@@ -21,6 +22,8 @@ Sound::Sound( QString name, int folderIndex, QObject *parent ) : QObject( parent
 
 void Sound::slot_calculateLevel( QAudioBuffer buffer )
 {
+    ARUCO_SCOPED_TIMER( "Sound::slot_calculateLevel" );
+
     qreal peakValue;
 
     if( buffer.frameCount() < 512 || buffer.format().channelCount() != 2 )
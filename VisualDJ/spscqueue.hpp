@@ -0,0 +1,104 @@
+#ifndef SPSCQUEUE_HPP
+#define SPSCQUEUE_HPP
+
+#include <QAtomicInt>
+#include <QSemaphore>
+
+// Bounded queue for exactly one producer thread and one consumer thread.
+// The semaphores count free slots and queued items, so push() and pop() can sleep
+// instead of spinning. Only the producer moves tail and only the consumer moves head.
+template< class T >
+class SpscQueue
+{
+private:
+
+    T *items;
+    int size;
+    QAtomicInt head;    // Next item to pop, written by the consumer
+    QAtomicInt tail;    // Next free slot, written by the producer
+    QSemaphore freeSlots;
+    QSemaphore queuedItems;
+
+    SpscQueue( const SpscQueue & );
+    SpscQueue &operator=( const SpscQueue & );
+
+    void write( const T &item )
+    {
+        int currentTail = tail.load();
+        items[ currentTail ] = item;
+        tail.storeRelease( ( currentTail + 1 ) % size );
+        queuedItems.release();
+    }
+
+    void take( T &item )
+    {
+        int currentHead = head.loadAcquire();
+        item = items[ currentHead ];
+        items[ currentHead ] = T();     // Do not keep references to the popped item
+        head.storeRelease( ( currentHead + 1 ) % size );
+        freeSlots.release();
+    }
+
+public:
+
+    explicit SpscQueue( int capacity ) : items( new T[ capacity ] ),
+                                         size( capacity ),
+                                         head( 0 ),
+                                         tail( 0 ),
+                                         freeSlots( capacity ),
+                                         queuedItems( 0 )
+    {
+    }
+
+    ~SpscQueue()
+    {
+        delete[] items;
+    }
+
+    // Returns false if the queue is full
+    bool tryPush( const T &item )
+    {
+        if( !freeSlots.tryAcquire() )
+            return false;
+
+        write( item );
+        return true;
+    }
+
+    // Waits up to timeoutMs for a free slot
+    bool push( const T &item, int timeoutMs )
+    {
+        if( !freeSlots.tryAcquire( 1, timeoutMs ) )
+            return false;
+
+        write( item );
+        return true;
+    }
+
+    // Returns false if the queue is empty
+    bool tryPop( T &item )
+    {
+        if( !queuedItems.tryAcquire() )
+            return false;
+
+        take( item );
+        return true;
+    }
+
+    // Waits up to timeoutMs for an item
+    bool pop( T &item, int timeoutMs )
+    {
+        if( !queuedItems.tryAcquire( 1, timeoutMs ) )
+            return false;
+
+        take( item );
+        return true;
+    }
+
+    int capacity() const
+    {
+        return size;
+    }
+};
+
+#endif // SPSCQUEUE_HPP
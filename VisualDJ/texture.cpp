@@ -1,4 +1,5 @@
 #include "texture.hpp"
+#include "aruco/ar_timers.h"
 
 Texture::Texture( QString name, QObject *parent ) : QObject( parent ), name( name ), id( 0 )
 {
@@ -7,6 +8,8 @@ Texture::Texture( QString name, QObject *parent ) : QObject( parent ), name( nam
 
 void Texture::generateFromMat()
 {
+    ARUCO_SCOPED_TIMER( "Texture::generateFromMat" );
+
     glBindTexture( GL_TEXTURE_2D, id );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
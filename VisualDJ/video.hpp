@@ -8,6 +8,8 @@
 #include <QFile>
 #include <QDir>
 
+#include "aruco/ar_timers.h"
+
 class Grabber : public QAbstractVideoSurface
 {
     Q_OBJECT
@@ -52,6 +54,8 @@ public:
 
     bool present( const QVideoFrame &frame )
     {
+        ARUCO_SCOPED_TIMER( "Grabber::present" );
+
         QVideoFrame cloneFrame( frame );
 
         if ( ! cloneFrame.map( QAbstractVideoBuffer::ReadOnly ))